@@ -0,0 +1,399 @@
+#include "BinaryProtocol.h"
+#include "ConfigStore.h"
+#include "SerialLog.h"
+#include "RunLog.h"
+#include "Telemetry.h"
+#include "RunStats.h"
+#include "WeeklySchedule.h"
+#include <util/crc16.h>
+#include <DS3232RTC.h>    // http://github.com/JChristensen/DS3232RTC
+
+#ifdef BINARY_PROTOCOL
+
+// type, sequence and CRC
+#define FRAME_OVERHEAD 4
+#define PARAM_SIZE 5
+#define LOG_RECORD_SIZE (5 + 3 * ZONE_COUNT)
+// params per frame of a FRAME_GET of all params, the frame fits into the send buffer of Serial
+#define GET_ALL_PARAMS_PER_FRAME 11
+
+static_assert(ZONE_COUNT <= PARAM_ZONE_VOLUME_LITRES - PARAM_ZONE_DURATION_SEC, "ZONE_COUNT too big for the param ids");
+static_assert(FRAME_OVERHEAD + LOG_RECORD_SIZE <= BINARY_FRAME_MAX_PAYLOAD, "a run log record does not fit into BINARY_FRAME_MAX_PAYLOAD");
+static_assert(FRAME_OVERHEAD + GET_ALL_PARAMS_PER_FRAME * PARAM_SIZE <= BINARY_FRAME_MAX_PAYLOAD, "GET_ALL_PARAMS_PER_FRAME too big");
+#ifdef SERIAL_TX_BUFFER_SIZE
+// availableForWrite() is one less than the buffer size at most
+static_assert(BINARY_FRAME_ENCODED_SIZE(LOG_RECORD_SIZE) < SERIAL_TX_BUFFER_SIZE, "a run log record does not fit into the send buffer");
+static_assert(BINARY_FRAME_ENCODED_SIZE(GET_ALL_PARAMS_PER_FRAME * PARAM_SIZE) < SERIAL_TX_BUFFER_SIZE, "GET_ALL_PARAMS_PER_FRAME too big for the send buffer");
+#endif
+
+BinaryProtocol binaryProtocol;
+
+static unsigned int calculateCrc(const byte *data, byte length) {
+  unsigned int crc = 0xFFFF;
+  for (byte i = 0; i < length; i++) {
+    crc = _crc_xmodem_update(crc, data[i]);
+  }
+  return crc;
+}
+
+void BinaryProtocol::receive() {
+  if (receiving && scheduler.getMillis() - lastReceiveMillis > BINARY_FRAME_TIMEOUT_MS) {
+    serialLog.println(F("binary frame timeout"));
+    receiving = false;
+    length = 0;
+  }
+  while (Serial.available() > 0 && (receiving || Serial.peek() == BINARY_FRAME_DELIMITER)) {
+    const byte value = Serial.read();
+    lastReceiveMillis = scheduler.getMillis();
+    if (value == BINARY_FRAME_DELIMITER) {
+      if (length > 0) {
+        handleFrame();
+        receiving = false;
+        length = 0;
+        return;
+      }
+      // start of a frame or an empty one
+      receiving = true;
+    } else if (length < sizeof(frame)) {
+      frame[length++] = value;
+    } else {
+      // too long, rejected when the frame ends
+      length = sizeof(frame) + 1;
+    }
+  }
+}
+
+void BinaryProtocol::sendFrame(byte type, byte sequence, const byte *data, byte dataLength) {
+  startResponse(type, sequence);
+  for (byte i = 0; i < dataLength; i++) {
+    addByte(data[i]);
+  }
+  sendResponse(false);
+}
+
+void BinaryProtocol::handleFrame() {
+  if (length > sizeof(frame) || !decode() || length < FRAME_OVERHEAD) {
+    sendError(0, FRAME_ERROR_LENGTH, 0);
+    return;
+  }
+  const byte type = frame[0];
+  const byte sequence = frame[1];
+  const byte dataLength = length - FRAME_OVERHEAD;
+  const unsigned int crc = frame[length - 2] | (frame[length - 1] << 8);
+  if (crc != calculateCrc(frame, length - 2)) {
+    sendError(sequence, FRAME_ERROR_CRC, 0);
+    return;
+  }
+  switch (type) {
+    case FRAME_GET:
+      handleGet(type, sequence, &frame[2], dataLength);
+      break;
+    case FRAME_SET:
+      handleSet(type, sequence, &frame[2], dataLength);
+      break;
+    case FRAME_GET_LOG:
+      handleGetLog(sequence);
+      break;
+    default:
+      sendError(sequence, FRAME_ERROR_TYPE, 0);
+  }
+}
+
+void BinaryProtocol::handleGet(byte type, byte sequence, const byte *ids, byte count) {
+  unsigned long value;
+  for (byte i = 0; i < count; i++) {
+    if (!getParam(ids[i], value)) {
+      sendError(sequence, FRAME_ERROR_PARAM, ids[i]);
+      return;
+    }
+  }
+
+  if (count == 0) {
+    // all params, sent by run()
+    startPending(type, sequence);
+    return;
+  }
+  startResponse(type, sequence);
+  for (byte i = 0; i < count; i++) {
+    getParam(ids[i], value);
+    if (responseLength + PARAM_SIZE > BINARY_FRAME_MAX_PAYLOAD - 2) {
+      sendResponse(true);
+      startResponse(type, sequence);
+    }
+    addByte(ids[i]);
+    addLong(value);
+  }
+  sendResponse(false);
+}
+
+void BinaryProtocol::handleSet(byte type, byte sequence, const byte *data, byte dataLength) {
+  if (dataLength % PARAM_SIZE != 0) {
+    sendError(sequence, FRAME_ERROR_LENGTH, 0);
+    return;
+  }
+  for (byte i = 0; i < dataLength; i += PARAM_SIZE) {
+    unsigned long value;
+    memcpy(&value, &data[i + 1], sizeof(value));
+    const byte error = checkParam(data[i], value);
+    if (error != 0) {
+      sendError(sequence, error, data[i]);
+      return;
+    }
+  }
+  for (byte i = 0; i < dataLength; i += PARAM_SIZE) {
+    unsigned long value;
+    memcpy(&value, &data[i + 1], sizeof(value));
+    setParam(data[i], value);
+  }
+  startResponse(type, sequence);
+  sendResponse(false);
+}
+
+void BinaryProtocol::handleGetLog(byte sequence) {
+  logCount = runLog.getCount();
+  if (logCount == 0) {
+    // no data, no records
+    scheduler.removeCallbacks(this);
+    pendingType = 0;
+    startResponse(FRAME_GET_LOG, sequence);
+    sendResponse(false);
+    return;
+  }
+  startPending(FRAME_GET_LOG, sequence);
+}
+
+void BinaryProtocol::startPending(byte type, byte sequence) {
+  scheduler.removeCallbacks(this);
+  pendingType = type;
+  pendingSequence = sequence;
+  pendingIndex = 0;
+  scheduler.schedule(this);
+}
+
+void BinaryProtocol::run() {
+  MEASURE_RUN(RUN_STATS_BINARY_PROTOCOL);
+  if (pendingType == 0) {
+    return;
+  }
+#ifdef SERIAL_TX_BUFFER_SIZE
+  // wait instead of blocking in Serial.write()
+  const byte dataLength = pendingType == FRAME_GET ? GET_ALL_PARAMS_PER_FRAME * PARAM_SIZE : LOG_RECORD_SIZE;
+  if (Serial.availableForWrite() < (int) BINARY_FRAME_ENCODED_SIZE(dataLength)) {
+    scheduler.scheduleDelayed(this, SERIAL_LOG_DRAIN_INTERVAL_MS);
+    return;
+  }
+#endif
+  const bool more = pendingType == FRAME_GET ? sendParams() : sendLogRecord();
+  if (more) {
+    scheduler.schedule(this);
+  } else {
+    pendingType = 0;
+  }
+}
+
+bool BinaryProtocol::sendParams() {
+  unsigned long value;
+  startResponse(FRAME_GET, pendingSequence);
+  for (byte added = 0; pendingIndex <= PARAM_LAST && added < GET_ALL_PARAMS_PER_FRAME; pendingIndex++) {
+    if (getParam(pendingIndex, value)) {
+      addByte(pendingIndex);
+      addLong(value);
+      added++;
+    }
+  }
+  // the frame is marked if there is another param after it
+  byte nextId = pendingIndex;
+  while (nextId <= PARAM_LAST && !getParam(nextId, value)) {
+    nextId++;
+  }
+  pendingIndex = nextId;
+  const bool more = nextId <= PARAM_LAST;
+  sendResponse(more);
+  return more;
+}
+
+bool BinaryProtocol::sendLogRecord() {
+  RunLogRecord record;
+  unsigned long startMinutes;
+  runLog.getRecord(pendingIndex, record, startMinutes);
+  pendingIndex++;
+  startResponse(FRAME_GET_LOG, pendingSequence);
+  addLong(startMinutes);
+  addByte(record.endReason);
+  for (byte zone = 0; zone < ZONE_COUNT; zone++) {
+    addByte(record.zones[zone].duration);
+    addByte(record.zones[zone].pulses);
+    addByte(record.zones[zone].pulses >> 8);
+  }
+  const bool more = pendingIndex < logCount;
+  sendResponse(more);
+  return more;
+}
+
+bool BinaryProtocol::getParam(byte id, unsigned long &value) {
+  if (id >= PARAM_ZONE_DURATION_SEC && id < PARAM_ZONE_DURATION_SEC + ZONE_COUNT) {
+    value = config.getZoneDurationSec(id - PARAM_ZONE_DURATION_SEC + 1);
+    return true;
+  }
+  if (id >= PARAM_ZONE_VOLUME_LITRES && id < PARAM_ZONE_VOLUME_LITRES + ZONE_COUNT) {
+    value = config.getZoneVolumeLitres(id - PARAM_ZONE_VOLUME_LITRES + 1);
+    return true;
+  }
+  switch (id) {
+    case PARAM_TIME:
+      value = RTC.get();
+      return true;
+    case PARAM_SERIAL_SLEEP_TIMEOUT_MS:
+      value = config.getSerialSleepTimeoutMs();
+      return true;
+    case PARAM_WATER_METER_STOP_THRESHOLD:
+      value = config.getWaterMeterStopThreshold();
+      return true;
+    case PARAM_IDLE_LEAK_LITRES:
+      value = config.getIdleLeakLitres();
+      return true;
+#ifdef TELEMETRY
+    case PARAM_TELEMETRY_INTERVAL_MS:
+      value = telemetry.getIntervalMs();
+      return true;
+#endif
+    case PARAM_WATCHDOG_RESET_COUNT:
+      value = config.getWatchdogResetCount();
+      return true;
+    case PARAM_USED_WATER:
+      value = waterManager->getUsedWater();
+      return true;
+    case PARAM_WATERING:
+      value = waterManager->isWatering();
+      return true;
+    case PARAM_UPTIME_MS:
+      value = scheduler.getMillis();
+      return true;
+    case PARAM_LOG_DROPPED:
+      value = serialLog.getDroppedCount();
+      return true;
+    case PARAM_IDLE_PULSES:
+      value = waterManager->getIdlePulses();
+      return true;
+  }
+  return false;
+}
+
+byte BinaryProtocol::checkParam(byte id, unsigned long value) {
+  if (id >= PARAM_ZONE_DURATION_SEC && id < PARAM_ZONE_DURATION_SEC + ZONE_COUNT) {
+    return value <= MAX_ZONE_DURATION ? 0 : FRAME_ERROR_VALUE;
+  }
+  if (id >= PARAM_ZONE_VOLUME_LITRES && id < PARAM_ZONE_VOLUME_LITRES + ZONE_COUNT) {
+    return value <= 0xFFFF ? 0 : FRAME_ERROR_VALUE;
+  }
+  switch (id) {
+    case PARAM_TIME:
+    case PARAM_SERIAL_SLEEP_TIMEOUT_MS:
+#ifdef TELEMETRY
+    case PARAM_TELEMETRY_INTERVAL_MS:
+#endif
+      return 0;
+    case PARAM_WATER_METER_STOP_THRESHOLD:
+      return value <= 0x7FFF ? 0 : FRAME_ERROR_VALUE;
+    case PARAM_IDLE_LEAK_LITRES:
+      return value <= MAX_IDLE_LEAK_LITRES ? 0 : FRAME_ERROR_VALUE;
+  }
+  // unknown or read only
+  return FRAME_ERROR_PARAM;
+}
+
+void BinaryProtocol::setParam(byte id, unsigned long value) {
+  if (id >= PARAM_ZONE_DURATION_SEC && id < PARAM_ZONE_DURATION_SEC + ZONE_COUNT) {
+    waterManager->setZoneDuration(id - PARAM_ZONE_DURATION_SEC + 1, value);
+  } else if (id >= PARAM_ZONE_VOLUME_LITRES && id < PARAM_ZONE_VOLUME_LITRES + ZONE_COUNT) {
+    waterManager->setZoneVolume(id - PARAM_ZONE_VOLUME_LITRES + 1, value);
+  } else if (id == PARAM_TIME) {
+    setTime(value);
+    RTC.set(value);
+    // the next start time is relative to the clock
+    weeklySchedule.programNextAlarm();
+  } else if (id == PARAM_SERIAL_SLEEP_TIMEOUT_MS) {
+    config.setSerialSleepTimeoutMs(value);
+  } else if (id == PARAM_WATER_METER_STOP_THRESHOLD) {
+    waterManager->setWaterMeterStopThreshold(value);
+  } else if (id == PARAM_IDLE_LEAK_LITRES) {
+    waterManager->setIdleLeakVolume(value);
+#ifdef TELEMETRY
+  } else if (id == PARAM_TELEMETRY_INTERVAL_MS) {
+    telemetry.setIntervalMs(value);
+#endif
+  }
+}
+
+void BinaryProtocol::startResponse(byte type, byte sequence) {
+  responseLength = 0;
+  addByte(type | FRAME_RESPONSE);
+  addByte(sequence);
+}
+
+void BinaryProtocol::addByte(byte value) {
+  // leave space for the CRC
+  if (responseLength < BINARY_FRAME_MAX_PAYLOAD - 2) {
+    response[responseLength++] = value;
+  }
+}
+
+void BinaryProtocol::addLong(unsigned long value) {
+  for (byte i = 0; i < 4; i++) {
+    addByte(value >> (8 * i));
+  }
+}
+
+void BinaryProtocol::sendResponse(bool more) {
+  if (more) {
+    response[0] |= FRAME_MORE;
+  }
+  const unsigned int crc = calculateCrc(response, responseLength);
+  response[responseLength++] = crc;
+  response[responseLength++] = crc >> 8;
+
+  // COBS: every block of up to 254 non-zero bytes is prefixed with its length + 1, the zero after it is dropped
+  Serial.write((byte) BINARY_FRAME_DELIMITER);
+  byte start = 0;
+  while (true) {
+    byte end = start;
+    while (end < responseLength && response[end] != 0 && end - start < 254) {
+      end++;
+    }
+    Serial.write(end - start + 1);
+    Serial.write(&response[start], end - start);
+    if (end == responseLength) {
+      break;
+    }
+    start = response[end] == 0 ? end + 1 : end;
+  }
+  Serial.write((byte) BINARY_FRAME_DELIMITER);
+}
+
+void BinaryProtocol::sendError(byte sequence, byte error, byte id) {
+  startResponse(FRAME_ERROR, sequence);
+  addByte(error);
+  addByte(id);
+  sendResponse(false);
+}
+
+bool BinaryProtocol::decode() {
+  byte read = 0;
+  byte write = 0;
+  while (read < length) {
+    const byte code = frame[read++];
+    if (read + code - 1 > length) {
+      return false;
+    }
+    for (byte i = 1; i < code; i++) {
+      frame[write++] = frame[read++];
+    }
+    if (code < 0xFF && read < length) {
+      frame[write++] = 0;
+    }
+  }
+  length = write;
+  return true;
+}
+
+#endif // BINARY_PROTOCOL
@@ -0,0 +1,139 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include "Arduino.h"
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+#include "WaterManager.h"
+#include "Constants.h"
+
+// starts and ends every frame, never part of the COBS encoded content
+#define BINARY_FRAME_DELIMITER 0
+// bytes of a decoded frame including type, sequence and CRC
+#define BINARY_FRAME_MAX_PAYLOAD 64
+// a frame that is not complete after this time is dropped
+#define BINARY_FRAME_TIMEOUT_MS 1000
+// bytes on the wire of a frame with dataLength bytes of data and up to 254 bytes in total
+#define BINARY_FRAME_ENCODED_SIZE(dataLength) ((dataLength) + 7)
+
+// frame types, the response has FRAME_RESPONSE set
+// data: ids of the params to get, none to get all. All params are sent in frames of up to
+// GET_ALL_PARAMS_PER_FRAME params, one per scheduler run like the records of FRAME_GET_LOG.
+#define FRAME_GET 0x01
+// data: id and value of each param to set, all are checked before any is set
+#define FRAME_SET 0x02
+// data: none, answered with one frame per record, oldest first. The records are sent one per scheduler run
+// so that watering is not delayed, a new request of all params or records restarts them.
+#define FRAME_GET_LOG 0x03
+// sent without request at the telemetry interval, data: TelemetryFrame
+#define FRAME_TELEMETRY 0x04
+// data: error code and the param id it refers to
+#define FRAME_ERROR 0x3F
+#define FRAME_RESPONSE 0x80
+// more response frames follow for the same request
+#define FRAME_MORE 0x40
+
+#define FRAME_ERROR_CRC 1
+#define FRAME_ERROR_LENGTH 2
+#define FRAME_ERROR_TYPE 3
+#define FRAME_ERROR_PARAM 4
+#define FRAME_ERROR_VALUE 5
+
+// params, values are 4 bytes little endian
+// read/write: seconds since 1970, sets the RTC
+#define PARAM_TIME 0x01
+#define PARAM_SERIAL_SLEEP_TIMEOUT_MS 0x02
+#define PARAM_WATER_METER_STOP_THRESHOLD 0x03
+// not stored, 0 to stop
+#define PARAM_TELEMETRY_INTERVAL_MS 0x04
+// litres per IDLE_LEAK_WINDOW_MS while idle, 0 to stop
+#define PARAM_IDLE_LEAK_LITRES 0x05
+// plus the zone index 0 to ZONE_COUNT - 1
+#define PARAM_ZONE_DURATION_SEC 0x10
+#define PARAM_ZONE_VOLUME_LITRES 0x30
+// read only
+#define PARAM_WATCHDOG_RESET_COUNT 0x50
+#define PARAM_USED_WATER 0x51
+#define PARAM_WATERING 0x52
+#define PARAM_UPTIME_MS 0x53
+#define PARAM_LOG_DROPPED 0x54
+#define PARAM_IDLE_PULSES 0x55
+// highest param id, a FRAME_GET of all params stops at it
+#define PARAM_LAST PARAM_IDLE_PULSES
+
+/**
+   Binary commands next to the ASCII console. A frame is BINARY_FRAME_DELIMITER, the COBS encoded payload
+   and BINARY_FRAME_DELIMITER again. The payload is type, sequence number, data and a CRC-16/CCITT-FALSE
+   over type, sequence and data, little endian. Every response repeats the sequence number of its request.
+   Log records are sent as start minutes since 1970 (4 bytes), end reason and per zone the duration and
+   pulses in the units of RunLog.h (1 and 2 bytes).
+*/
+class BinaryProtocol: public Runnable {
+  public:
+    BinaryProtocol(): receiving(false), length(0), pendingType(0) {}
+    /**
+       @param waterManager the waterManager to forward changes to, cannot be null
+    */
+    inline void setWaterManager(WaterManager *waterManager) {
+      BinaryProtocol::waterManager = waterManager;
+    }
+    /**
+       returns true if a frame was started but not completed yet.
+    */
+    inline bool isReceiving() const {
+      return receiving;
+    }
+    /**
+       reads the available bytes of a frame and handles it once it is complete.
+       Returns after at most one frame.
+    */
+    void receive();
+    /**
+       sends a frame that was not requested.
+       @param type one of FRAME_*, FRAME_RESPONSE is added
+       @param data up to BINARY_FRAME_MAX_PAYLOAD - 4 bytes
+    */
+    void sendFrame(byte type, byte sequence, const byte *data, byte dataLength);
+    /**
+       do not call from external, used internally to send all params or the log records.
+    */
+    void run();
+  private:
+    WaterManager *waterManager;
+    bool receiving;
+    // the encoded frame while receiving, decoded in place
+    byte frame[BINARY_FRAME_MAX_PAYLOAD + 1];
+    byte length;
+    unsigned long lastReceiveMillis;
+    byte response[BINARY_FRAME_MAX_PAYLOAD];
+    byte responseLength;
+    // the response of a FRAME_GET of all params or of a FRAME_GET_LOG in progress, pendingType is 0 if none
+    byte pendingType;
+    byte pendingSequence;
+    // the next param id or log record
+    byte pendingIndex;
+    byte logCount;
+
+    void handleFrame();
+    void handleGet(byte type, byte sequence, const byte *ids, byte count);
+    void handleSet(byte type, byte sequence, const byte *data, byte dataLength);
+    void handleGetLog(byte sequence);
+    void startPending(byte type, byte sequence);
+    // send the next frame of the pending response, return true if more follow
+    bool sendParams();
+    bool sendLogRecord();
+    bool getParam(byte id, unsigned long &value);
+    byte checkParam(byte id, unsigned long value);
+    void setParam(byte id, unsigned long value);
+
+    void startResponse(byte type, byte sequence);
+    void addByte(byte value);
+    void addLong(unsigned long value);
+    void sendResponse(bool more);
+    void sendError(byte sequence, byte error, byte id);
+    bool decode();
+};
+
+extern BinaryProtocol binaryProtocol;
+
+#endif
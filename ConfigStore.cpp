@@ -0,0 +1,280 @@
+
+#include "ConfigStore.h"
+#include <EEPROM.h>
+#include <EEPROMWearLevel.h> // https://github.com/PRosenb/EEPROMWearLevel
+#include "RunStats.h"
+
+ConfigStore config;
+
+// the tables share what the single values leave of EEPROM_LENGTH_TO_USE, each with the same amount of copies
+#define EEPROM_TABLES_LENGTH (EEPROM_LENGTH_TO_USE - EEPROMWL_HEADER_LENGTH \
+                              - (EEPROM_INDEX_COUNT - EEPROM_TABLE_INDEX_COUNT) * EEPROM_INDEX_LENGTH)
+// EEPROMWL_INDEX_LENGTH() rounds up by less than one byte per table
+#define EEPROM_TABLE_COPIES ((EEPROM_TABLES_LENGTH - EEPROM_TABLE_INDEX_COUNT) * 8 / 9 \
+                             / (sizeof(ZoneSettingsTable) + sizeof(ScheduleTable) + sizeof(ZoneFlowTable)))
+#define EEPROM_INDEX_LENGTH_ZONES EEPROMWL_INDEX_LENGTH(EEPROM_TABLE_COPIES * sizeof(ZoneSettingsTable))
+#define EEPROM_INDEX_LENGTH_SCHEDULE EEPROMWL_INDEX_LENGTH(EEPROM_TABLE_COPIES * sizeof(ScheduleTable))
+#define EEPROM_INDEX_LENGTH_ZONE_FLOW EEPROMWL_INDEX_LENGTH(EEPROM_TABLE_COPIES * sizeof(ZoneFlowTable))
+
+static_assert(EEPROM_INDEX_COUNT <= 32, "dirtyIndexes has one bit per EEPROM index");
+// at least two copies so that the wear is spread
+static_assert(EEPROMWL_DATA_LENGTH(EEPROM_INDEX_LENGTH) >= 2 * sizeof(unsigned long), "EEPROM_INDEX_LENGTH too small");
+static_assert(EEPROM_TABLE_COPIES >= 2, "EEPROM_LENGTH_TO_USE too small for ZONE_COUNT and SCHEDULE_MAX_ENTRIES");
+static_assert(EEPROM_INDEX_LENGTH_ZONES + EEPROM_INDEX_LENGTH_SCHEDULE + EEPROM_INDEX_LENGTH_ZONE_FLOW <= EEPROM_TABLES_LENGTH,
+              "EEPROM_LENGTH_TO_USE too small for the EEPROM indexes");
+
+// Older layouts of EEPROMwl, see readLegacyLayout().
+// The watchdog reset count and the serial sleep timeout have the same indexes in all of them.
+// 1: the first release, indexes of the same length
+#define LAYOUT1_INDEX_COUNT 6
+#define LAYOUT1_LENGTH_TO_USE 128
+#define LAYOUT1_INDEX_ZONE1 2
+#define LAYOUT1_INDEX_WATER_METER_THRESHOLD 5
+#define LAYOUT1_ZONE_COUNT 3
+// 8: an index per zone value, as it was built with 3 zones
+#define LAYOUT8_INDEX_COUNT 13
+#define LAYOUT8_INDEX_ZONE1 2
+#define LAYOUT8_INDEX_WATER_METER_THRESHOLD 5
+#define LAYOUT8_INDEX_CONFIG_VERSION 6
+#define LAYOUT8_INDEX_ZONE_VOLUME1 7
+#define LAYOUT8_INDEX_SCHEDULE 10
+#define LAYOUT8_INDEX_IDLE_LEAK_LITRES 11
+#define LAYOUT8_INDEX_ZONE_FLOW 12
+#define LAYOUT8_ZONE_COUNT 3
+#define LAYOUT8_SCHEDULE_MAX_ENTRIES 14
+
+static const int layout8IndexLengths[LAYOUT8_INDEX_COUNT] = {32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 200, 32, 68};
+
+struct Layout8ScheduleTable {
+  byte count;
+  struct {
+    unsigned int minuteOfWeek;
+    byte zones;
+  } entries[LAYOUT8_SCHEDULE_MAX_ENTRIES];
+};
+
+// filled by begin(), static as EEPROMwl might keep it
+static int eepromIndexLengths[EEPROM_INDEX_COUNT];
+
+void ConfigStore::begin() {
+  watchdogResetCount = 0;
+  serialSleepTimeoutMs = SERIAL_SLEEP_TIMEOUT_MS_DEFAULT;
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    zones.zones[i].durationSec = getZoneDefaultDurationSec(i);
+    zones.zones[i].volumeLitres = 0;
+  }
+  waterMeterStopThreshold = DEFAULT_WATER_METER_STOP_THRESHOLD;
+  idleLeakLitres = DEFAULT_IDLE_LEAK_LITRES;
+  memset(&zoneFlows, 0, sizeof(zoneFlows));
+  schedule.count = 0;
+
+  // EEPROMwl clears all values when the layout changes, the ones of a known older layout are read before
+  byte configVersion = 0;
+  const byte storedLayoutVersion = EEPROM.read(EEPROMWL_VERSION_ADDRESS);
+  const bool layoutChanged = storedLayoutVersion != EEPROM_VERSION;
+  if (layoutChanged) {
+    configVersion = readLegacyLayout(storedLayoutVersion);
+  }
+
+  for (byte i = 0; i < EEPROM_INDEX_COUNT; i++) {
+    eepromIndexLengths[i] = EEPROM_INDEX_LENGTH;
+  }
+  eepromIndexLengths[EEPROM_INDEX_ZONES] = EEPROM_INDEX_LENGTH_ZONES;
+  eepromIndexLengths[EEPROM_INDEX_SCHEDULE] = EEPROM_INDEX_LENGTH_SCHEDULE;
+  eepromIndexLengths[EEPROM_INDEX_ZONE_FLOW] = EEPROM_INDEX_LENGTH_ZONE_FLOW;
+  EEPROMwl.begin(EEPROM_VERSION, eepromIndexLengths, EEPROM_INDEX_COUNT);
+
+  if (!layoutChanged) {
+    EEPROMwl.get(EEPROM_INDEX_CONFIG_VERSION, configVersion);
+    EEPROMwl.get(EEPROM_INDEX_WATCHDOG_RESET_COUNT, watchdogResetCount);
+    EEPROMwl.get(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
+    EEPROMwl.get(EEPROM_INDEX_ZONES, zones);
+    EEPROMwl.get(EEPROM_INDEX_WATER_METER_THRESHOLD, waterMeterStopThreshold);
+    EEPROMwl.get(EEPROM_INDEX_IDLE_LEAK_LITRES, idleLeakLitres);
+    EEPROMwl.get(EEPROM_INDEX_ZONE_FLOW, zoneFlows);
+    EEPROMwl.get(EEPROM_INDEX_SCHEDULE, schedule);
+  }
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    // set limit
+    if (zones.zones[i].durationSec > MAX_ZONE_DURATION) {
+      zones.zones[i].durationSec = MAX_ZONE_DURATION;
+    }
+  }
+  if (schedule.count > SCHEDULE_MAX_ENTRIES) {
+    schedule.count = 0;
+  }
+
+  if (layoutChanged) {
+    // the new layout starts empty, all values are written
+    dirtyIndexes = ~0UL;
+    writeWatchdogResetCount(watchdogResetCount);
+  }
+  if (layoutChanged || configVersion != CONFIG_VERSION) {
+    migrate(configVersion);
+    configVersion = CONFIG_VERSION;
+    EEPROMwl.put(EEPROM_INDEX_CONFIG_VERSION, configVersion);
+    commit();
+  }
+}
+
+byte ConfigStore::readLegacyLayout(const byte layoutVersion) {
+  byte configVersion = 0;
+  if (layoutVersion == 1) {
+    EEPROMwl.begin(layoutVersion, LAYOUT1_INDEX_COUNT, LAYOUT1_LENGTH_TO_USE);
+    for (byte i = 0; i < ZONE_COUNT && i < LAYOUT1_ZONE_COUNT; i++) {
+      EEPROMwl.get(LAYOUT1_INDEX_ZONE1 + i, zones.zones[i].durationSec);
+    }
+    EEPROMwl.get(LAYOUT1_INDEX_WATER_METER_THRESHOLD, waterMeterStopThreshold);
+    // the meaning of the values is the one of the first CONFIG_VERSION
+    configVersion = 1;
+  } else if (layoutVersion == 8) {
+    EEPROMwl.begin(layoutVersion, layout8IndexLengths, LAYOUT8_INDEX_COUNT);
+    EEPROMwl.get(LAYOUT8_INDEX_CONFIG_VERSION, configVersion);
+    for (byte i = 0; i < ZONE_COUNT && i < LAYOUT8_ZONE_COUNT; i++) {
+      EEPROMwl.get(LAYOUT8_INDEX_ZONE1 + i, zones.zones[i].durationSec);
+      EEPROMwl.get(LAYOUT8_INDEX_ZONE_VOLUME1 + i, zones.zones[i].volumeLitres);
+    }
+    EEPROMwl.get(LAYOUT8_INDEX_WATER_METER_THRESHOLD, waterMeterStopThreshold);
+    EEPROMwl.get(LAYOUT8_INDEX_IDLE_LEAK_LITRES, idleLeakLitres);
+
+    ZoneFlow legacyZoneFlows[LAYOUT8_ZONE_COUNT];
+    memset(legacyZoneFlows, 0, sizeof(legacyZoneFlows));
+    EEPROMwl.get(LAYOUT8_INDEX_ZONE_FLOW, legacyZoneFlows);
+    for (byte i = 0; i < ZONE_COUNT && i < LAYOUT8_ZONE_COUNT; i++) {
+      zoneFlows.zones[i] = legacyZoneFlows[i];
+    }
+
+    Layout8ScheduleTable legacySchedule;
+    legacySchedule.count = 0;
+    EEPROMwl.get(LAYOUT8_INDEX_SCHEDULE, legacySchedule);
+    for (byte i = 0; i < legacySchedule.count && i < LAYOUT8_SCHEDULE_MAX_ENTRIES && i < SCHEDULE_MAX_ENTRIES; i++) {
+      schedule.entries[i].minuteOfWeek = legacySchedule.entries[i].minuteOfWeek;
+      schedule.entries[i].zones = legacySchedule.entries[i].zones & ALL_ZONES;
+      schedule.count = i + 1;
+    }
+  } else {
+    return 0;
+  }
+  EEPROMwl.get(EEPROM_INDEX_WATCHDOG_RESET_COUNT, watchdogResetCount);
+  EEPROMwl.get(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
+  return configVersion;
+}
+
+void ConfigStore::migrate(byte fromVersion) {
+  // Add a case for every CONFIG_VERSION that changes the meaning of stored values.
+  // Version 0 means nothing was stored yet or the layout was not known, the defaults are used then.
+  switch (fromVersion) {
+    case 0:
+      // write the defaults so that all values are persisted
+      dirtyIndexes = ~0UL;
+      break;
+  }
+}
+
+void ConfigStore::writeWatchdogResetCount(int watchdogResetCount) {
+  ConfigStore::watchdogResetCount = watchdogResetCount;
+  EEPROMwl.put(EEPROM_INDEX_WATCHDOG_RESET_COUNT, watchdogResetCount);
+}
+
+void ConfigStore::setSerialSleepTimeoutMs(unsigned long serialSleepTimeoutMs) {
+  ConfigStore::serialSleepTimeoutMs = serialSleepTimeoutMs;
+  markDirty(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS);
+}
+
+unsigned int ConfigStore::getZoneDurationSec(byte zone) const {
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    return zones.zones[zone - 1].durationSec;
+  }
+  return 0;
+}
+
+void ConfigStore::setZoneDurationSec(byte zone, unsigned int durationSec) {
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    zones.zones[zone - 1].durationSec = durationSec;
+    markDirty(EEPROM_INDEX_ZONES);
+  }
+}
+
+unsigned int ConfigStore::getZoneVolumeLitres(byte zone) const {
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    return zones.zones[zone - 1].volumeLitres;
+  }
+  return 0;
+}
+
+void ConfigStore::setZoneVolumeLitres(byte zone, unsigned int volumeLitres) {
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    zones.zones[zone - 1].volumeLitres = volumeLitres;
+    markDirty(EEPROM_INDEX_ZONES);
+  }
+}
+
+void ConfigStore::setWaterMeterStopThreshold(unsigned int waterMeterStopThreshold) {
+  ConfigStore::waterMeterStopThreshold = waterMeterStopThreshold;
+  markDirty(EEPROM_INDEX_WATER_METER_THRESHOLD);
+}
+
+void ConfigStore::setIdleLeakLitres(unsigned int idleLeakLitres) {
+  ConfigStore::idleLeakLitres = idleLeakLitres;
+  markDirty(EEPROM_INDEX_IDLE_LEAK_LITRES);
+}
+
+const ZoneFlow &ConfigStore::getZoneFlow(byte zone) const {
+  // unknown flow for an invalid zone
+  static const ZoneFlow noZoneFlow = {0, 0, 0};
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    return zoneFlows.zones[zone - 1];
+  }
+  return noZoneFlow;
+}
+
+void ConfigStore::setZoneFlow(byte zone, const ZoneFlow &zoneFlow) {
+  if (zone >= 1 && zone <= ZONE_COUNT) {
+    zoneFlows.zones[zone - 1] = zoneFlow;
+    markDirty(EEPROM_INDEX_ZONE_FLOW);
+  }
+}
+
+void ConfigStore::clearZoneFlows() {
+  memset(&zoneFlows, 0, sizeof(zoneFlows));
+  markDirty(EEPROM_INDEX_ZONE_FLOW);
+}
+
+void ConfigStore::scheduleChanged() {
+  markDirty(EEPROM_INDEX_SCHEDULE);
+}
+
+void ConfigStore::markDirty(byte eepromIndex) {
+  dirtyIndexes |= 1UL << eepromIndex;
+  if (!scheduler.isScheduled(this)) {
+    scheduler.scheduleDelayed(this, CONFIG_COMMIT_DELAY_MS);
+  }
+}
+
+void ConfigStore::commit() {
+  scheduler.removeCallbacks(this);
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS)) {
+    EEPROMwl.put(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
+  }
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_ZONES)) {
+    EEPROMwl.put(EEPROM_INDEX_ZONES, zones);
+  }
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_WATER_METER_THRESHOLD)) {
+    EEPROMwl.put(EEPROM_INDEX_WATER_METER_THRESHOLD, waterMeterStopThreshold);
+  }
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_SCHEDULE)) {
+    EEPROMwl.put(EEPROM_INDEX_SCHEDULE, schedule);
+  }
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_IDLE_LEAK_LITRES)) {
+    EEPROMwl.put(EEPROM_INDEX_IDLE_LEAK_LITRES, idleLeakLitres);
+  }
+  if (dirtyIndexes & (1UL << EEPROM_INDEX_ZONE_FLOW)) {
+    EEPROMwl.put(EEPROM_INDEX_ZONE_FLOW, zoneFlows);
+  }
+  dirtyIndexes = 0;
+}
+
+void ConfigStore::run() {
+  MEASURE_RUN(RUN_STATS_CONFIG_STORE);
+  commit();
+}
@@ -0,0 +1,125 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include "Arduino.h"
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+#include "Constants.h"
+#include "Zones.h"
+#include "WeeklySchedule.h"
+#include "ZoneFlow.h"
+
+// delay to collect more changes before they are written to EEPROM
+#define CONFIG_COMMIT_DELAY_MS 2000
+
+#define SERIAL_SLEEP_TIMEOUT_MS_DEFAULT 120000
+#define DEFAULT_DURATION_AUTOMATIC1_SEC 60U * 5U
+#define DEFAULT_DURATION_AUTOMATIC2_SEC 60U * 5U
+#define DEFAULT_DURATION_AUTOMATIC3_SEC 60U * 1U
+#define MAX_ZONE_DURATION 3600U
+// free flow around 68 per second
+#define DEFAULT_WATER_METER_STOP_THRESHOLD 68U
+// volume that flows within IDLE_LEAK_WINDOW_MS while the valves are closed to report a leak
+#define DEFAULT_IDLE_LEAK_LITRES 1U
+
+/**
+   Holds all configuration values in RAM. They are read from EEPROM once in begin().
+   Changed values are written together after CONFIG_COMMIT_DELAY_MS.
+*/
+class ConfigStore: public Runnable {
+  public:
+    ConfigStore(): dirtyIndexes(0) {}
+    /**
+       initialises EEPROMwl and reads all values. Migrates them if CONFIG_VERSION changed and carries them over
+       from a known older layout if EEPROM_VERSION changed. Zone durations are limited to MAX_ZONE_DURATION.
+    */
+    void begin();
+
+    inline int getWatchdogResetCount() const {
+      return watchdogResetCount;
+    }
+    /**
+       writes immediately as it is called right before a watchdog reset.
+    */
+    void writeWatchdogResetCount(int watchdogResetCount);
+
+    inline unsigned long getSerialSleepTimeoutMs() const {
+      return serialSleepTimeoutMs;
+    }
+    void setSerialSleepTimeoutMs(unsigned long serialSleepTimeoutMs);
+
+    /**
+       @param zone number of the zone, 1 to ZONE_COUNT
+    */
+    unsigned int getZoneDurationSec(byte zone) const;
+    void setZoneDurationSec(byte zone, unsigned int durationSec);
+    /**
+       @param zone number of the zone, 1 to ZONE_COUNT
+       @return litres after which the zone is stopped, 0 to water for the duration only
+    */
+    unsigned int getZoneVolumeLitres(byte zone) const;
+    void setZoneVolumeLitres(byte zone, unsigned int volumeLitres);
+
+    inline unsigned int getWaterMeterStopThreshold() const {
+      return waterMeterStopThreshold;
+    }
+    void setWaterMeterStopThreshold(unsigned int waterMeterStopThreshold);
+
+    /**
+       @return litres within IDLE_LEAK_WINDOW_MS while idle that are reported as leak, 0 if not monitored
+    */
+    inline unsigned int getIdleLeakLitres() const {
+      return idleLeakLitres;
+    }
+    void setIdleLeakLitres(unsigned int idleLeakLitres);
+
+    /**
+       @param zone number of the zone, 1 to ZONE_COUNT
+    */
+    const ZoneFlow &getZoneFlow(byte zone) const;
+    void setZoneFlow(byte zone, const ZoneFlow &zoneFlow);
+    /**
+       forgets the learned flow of all zones, e.g. after sprinklers were changed.
+    */
+    void clearZoneFlows();
+
+    /**
+       the table can be changed directly, call scheduleChanged() afterwards to store it.
+    */
+    inline ScheduleTable &getSchedule() {
+      return schedule;
+    }
+    void scheduleChanged();
+
+    /**
+       writes all changed values to EEPROM now.
+    */
+    void commit();
+    /**
+       do not call from external, used internally to commit delayed.
+    */
+    void run();
+  private:
+    int watchdogResetCount;
+    unsigned long serialSleepTimeoutMs;
+    ZoneSettingsTable zones;
+    unsigned int waterMeterStopThreshold;
+    ScheduleTable schedule;
+    unsigned int idleLeakLitres;
+    ZoneFlowTable zoneFlows;
+    // bit per EEPROM index that needs to be written
+    unsigned long dirtyIndexes;
+
+    /**
+       reads the values of an older layout before EEPROMwl.begin() clears them for EEPROM_VERSION.
+       Only the first zones are carried over if the layout had fewer zones.
+       @return the CONFIG_VERSION of the values read, 0 if the layout is not known
+    */
+    byte readLegacyLayout(byte layoutVersion);
+    void migrate(byte fromVersion);
+    void markDirty(byte eepromIndex);
+};
+
+extern ConfigStore config;
+
+#endif
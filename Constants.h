@@ -3,6 +3,17 @@
 // ----------------------------------------------------------------------------------
 #define CHECK_WATER_METER_AVAILABLE
 #define LEAK_CHECK
+// measure the scheduler callbacks, print with command sr
+// off by default, the statistics take 196 bytes of RAM
+//#define RUN_STATS
+// water consecutive zones at the same time if their learned flow stays below the stop threshold
+#define PARALLEL_ZONES
+// stop if the flow of a zone leaves the range learned over its previous runs, see ZoneFlow.h
+#define ZONE_FLOW_SUPERVISION
+// framed binary commands next to the ASCII console, see BinaryProtocol.h
+#define BINARY_PROTOCOL
+// binary status frames at an interval set with command wt, needs BINARY_PROTOCOL, see Telemetry.h
+#define TELEMETRY
 
 // ----------------------------------------------------------------------------------
 // PINs
@@ -10,7 +21,9 @@
 #define BLUETOOTH_ENABLE_PIN 2
 // unused 3
 
+// main valve
 #define VALVE1_PIN 4
+// zone valves, assigned to the zones in Zones.cpp
 #define VALVE2_PIN 5
 #define VALVE3_PIN 6
 #define VALVE4_PIN 7
@@ -22,6 +35,8 @@
 #define MODE_PIN 11
 
 #define WATER_METER_PIN 12
+// pulses of the water meter per litre, set to 1 to configure the zone volumes in pulses
+#define WATER_METER_PULSES_PER_LITRE 450
 
 #define DEEP_SLEEP_SCHEDULER_AWAKE_INDICATION_PIN 13
 
@@ -37,17 +52,64 @@
 
 // potential PinChangePins on Leonardo: 8, 9, 10, 11
 
+// ----------------------------------------------------------------------------------
+// Zones
+// ----------------------------------------------------------------------------------
+// amount of entries in zoneDescriptors in Zones.cpp.
+// Changing it changes the EEPROM layout, increase EEPROM_VERSION then. More zones leave fewer copies of the tables
+// in EEPROM for the wear levelling, see ConfigStore.cpp.
+#define ZONE_COUNT 3
+
+// ----------------------------------------------------------------------------------
+// Schedule
+// ----------------------------------------------------------------------------------
+// amount of start times of the weekly schedule, each needs 3 bytes RAM and EEPROM with up to 8 zones.
+// Changing it changes the EEPROM layout, increase EEPROM_VERSION then.
+#define SCHEDULE_MAX_ENTRIES 14
+
+// ----------------------------------------------------------------------------------
+// Memory
+// ----------------------------------------------------------------------------------
+// bytes reserved for the objects created at startup, see StaticArena.h
+// The host build in tools/replay has wider types and defines its own values for this and EEPROM_LENGTH_TO_USE.
+#ifndef ARENA_SIZE
+#define ARENA_SIZE 288
+#endif
+
 // ----------------------------------------------------------------------------------
 // EEPROM
 // ----------------------------------------------------------------------------------
-#define EEPROM_VERSION 1
-#define EEPROM_LENGTH_TO_USE 128
-#define EEPROM_INDEX_COUNT 6
+// layout of EEPROMwl, add the previous one to ConfigStore::readLegacyLayout() when changing it, otherwise the
+// stored values are cleared
+#define EEPROM_VERSION 9
+// part of the EEPROM used by EEPROMwl
+#ifndef EEPROM_LENGTH_TO_USE
+#define EEPROM_LENGTH_TO_USE 640
+#endif
+#define EEPROM_INDEX_COUNT (EEPROM_INDEX_ZONE_FLOW + 1)
+// bytes per index of a single value including the control bytes of EEPROMwl, the values are rewritten until all
+// copies are used up. The tables get the rest of EEPROM_LENGTH_TO_USE, see ConfigStore.cpp.
+#define EEPROM_INDEX_LENGTH 32
+// EEPROMwl uses a header byte for the layout version and one control bit per data byte of an index
+#define EEPROMWL_HEADER_LENGTH 1
+#define EEPROMWL_VERSION_ADDRESS 0
+#define EEPROMWL_DATA_LENGTH(indexLength) ((indexLength) - ((indexLength) + 8) / 9)
+#define EEPROMWL_INDEX_LENGTH(dataLength) ((dataLength) + ((dataLength) + 7) / 8)
+// meaning of the stored values, see ConfigStore::migrate()
+#define CONFIG_VERSION 1
+// ring of the latest runs after the EEPROMwl part, see RunLog.h
+#define RUN_LOG_START EEPROM_LENGTH_TO_USE
+#define RUN_LOG_LENGTH 384
 
 #define EEPROM_INDEX_WATCHDOG_RESET_COUNT 0
 #define EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS 1
-#define EEPROM_INDEX_ZONE1 2
-#define EEPROM_INDEX_ZONE2 3
-#define EEPROM_INDEX_ZONE3 4
-#define EEPROM_INDEX_WATER_METER_THRESHOLD 5
+#define EEPROM_INDEX_WATER_METER_THRESHOLD 2
+#define EEPROM_INDEX_CONFIG_VERSION 3
+#define EEPROM_INDEX_IDLE_LEAK_LITRES 4
+// the tables come last, duration and volume of all zones in one index
+#define EEPROM_INDEX_ZONES 5
+#define EEPROM_INDEX_SCHEDULE 6
+// learned flow of all zones in one index
+#define EEPROM_INDEX_ZONE_FLOW 7
+#define EEPROM_TABLE_INDEX_COUNT 3
 
@@ -0,0 +1,38 @@
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include "Arduino.h"
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+
+#define DEBOUNCE_MS 200
+
+/**
+   Ignores repeated edges of a button without blocking. Use one instance per input PIN.
+   The ISR schedules the callback as before and the callback asks accept() if it should act.
+*/
+class Debouncer {
+  public:
+    Debouncer(const unsigned long debounceMs = DEBOUNCE_MS): debounceMs(debounceMs), lastAcceptedMs(0), acceptedBefore(false) {
+    }
+    /**
+       returns true if no edge was accepted within the last debounceMs.
+       Call it from the scheduled callback, not from the ISR. After waking up from deep sleep,
+       the scheduler time is only updated when the callbacks are executed.
+    */
+    bool accept() {
+      const unsigned long nowMs = scheduler.getMillis();
+      if (acceptedBefore && nowMs - lastAcceptedMs < debounceMs) {
+        return false;
+      }
+      acceptedBefore = true;
+      lastAcceptedMs = nowMs;
+      return true;
+    }
+  private:
+    const unsigned long debounceMs;
+    unsigned long lastAcceptedMs;
+    bool acceptedBefore;
+};
+
+#endif
@@ -1,11 +1,15 @@
 
 #include "DurationFsm.h"
+#include "FsmTrace.h"
+#include "RunStats.h"
+#include <util/atomic.h>
 
 //DURATION FSM
 #define LIBCALL_DEEP_SLEEP_SCHEDULER
 #include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
 
-DurationFsm::DurationFsm(DurationState& current, const String name): FiniteStateMachine(current, name) {
+DurationFsm::DurationFsm(DurationState& current, const __FlashStringHelper *name): FiniteStateMachine(current, name) {
+  stateChangeTime = scheduler.getMillis();
   if (current.minDurationMs > 0 && current.nextState != NULL) {
     scheduler.scheduleDelayed(this, current.minDurationMs);
   }
@@ -54,7 +58,141 @@ unsigned long DurationFsm::timeInCurrentState() {
 }
 
 void DurationFsm::run() {
+  MEASURE_RUN(RUN_STATS_DURATION_FSM);
   immediatelyChangeToNextState();
 }
 
 //END DURATION FSM
+
+//TABLE DURATION FSM
+TableDurationFsm::TableDurationFsm(const DurationTransition *transitions, byte initialState, DurationTransitionListener *listener, const __FlashStringHelper *name,
+                                   const EventTransition *eventTransitions, byte eventTransitionCount)
+  : transitions(transitions), listener(listener), name(name), traceSource(fsmTrace.addSource(this)), currentState(initialState),
+    eventTransitions(eventTransitions), eventTransitionCount(eventTransitionCount), eventsFirst(0), eventsCount(0), eventDispatcher(*this) {
+  stateChangeTime = scheduler.getMillis();
+  scheduleNextState(initialState);
+}
+
+byte TableDurationFsm::immediatelyChangeToNextState() {
+  DurationTransition transition;
+  readTransition(currentState, transition);
+  if (transition.nextState != NO_NEXT_STATE) {
+    changeState(listener->getNextState(currentState, transition.nextState));
+  } else {
+    // we do not call changeState() so we need to ensure the callback is cancelled.
+    scheduler.removeCallbacks(this);
+  }
+  return currentState;
+}
+
+TableDurationFsm& TableDurationFsm::changeState(byte state) {
+  scheduler.removeCallbacks(this);
+  scheduleNextState(state);
+  if (currentState != state) {
+    switchState(state);
+  }
+  return *this;
+}
+
+TableDurationFsm& TableDurationFsm::reenterState() {
+  scheduler.removeCallbacks(this);
+  scheduleNextState(currentState);
+  switchState(currentState);
+  return *this;
+}
+
+void TableDurationFsm::scheduleNextState(byte state) {
+  DurationTransition transition;
+  readTransition(state, transition);
+  if (transition.nextState != NO_NEXT_STATE) {
+    unsigned long minDurationMs = listener->getMinDurationMs(state, transition.minDurationMs);
+    if (minDurationMs > 0) {
+      scheduler.scheduleDelayed(this, minDurationMs);
+    }
+  }
+}
+
+void TableDurationFsm::switchState(byte state) {
+  listener->exitState(currentState);
+  // events posted for the state that is left, e.g. a pulse count of the previous zone, do not apply to the new one
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    eventsCount = 0;
+  }
+
+  fsmTrace.record(traceSource, currentState, state);
+
+  currentState = state;
+  listener->enterState(state);
+  stateChangeTime = scheduler.getMillis();
+}
+
+const __FlashStringHelper *TableDurationFsm::getStateName(byte state) const {
+  DurationTransition transition;
+  readTransition(state, transition);
+  return (const __FlashStringHelper *) transition.name;
+}
+
+const __FlashStringHelper *TableDurationFsm::getTraceName() const {
+  return name;
+}
+
+const __FlashStringHelper *TableDurationFsm::getTraceStateName(byte state) const {
+  return getStateName(state);
+}
+
+unsigned long TableDurationFsm::timeInCurrentState() {
+  return scheduler.getMillis() - stateChangeTime;
+}
+
+void TableDurationFsm::run() {
+  MEASURE_RUN(RUN_STATS_DURATION_FSM);
+  immediatelyChangeToNextState();
+}
+
+bool TableDurationFsm::postEvent(byte event) {
+  bool queued = false;
+  // keeps interrupts disabled if called from an interrupt
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (eventsCount < FSM_EVENT_QUEUE_SIZE) {
+      events[(eventsFirst + eventsCount) % FSM_EVENT_QUEUE_SIZE] = event;
+      eventsCount++;
+      queued = true;
+    }
+  }
+  if (queued) {
+    scheduler.schedule(&eventDispatcher);
+  }
+  return queued;
+}
+
+void TableDurationFsm::dispatchEvents() {
+  while (true) {
+    noInterrupts();
+    if (eventsCount == 0) {
+      interrupts();
+      return;
+    }
+    const byte event = events[eventsFirst];
+    eventsFirst = (eventsFirst + 1) % FSM_EVENT_QUEUE_SIZE;
+    eventsCount--;
+    interrupts();
+    handleEvent(event);
+  }
+}
+
+void TableDurationFsm::handleEvent(byte event) {
+  for (byte i = 0; i < eventTransitionCount; i++) {
+    EventTransition transition;
+    memcpy_P(&transition, &eventTransitions[i], sizeof(EventTransition));
+    if ((transition.state == currentState || transition.state == ANY_STATE) && transition.event == event
+        && (transition.guard == NO_GUARD || listener->checkGuard(transition.guard))) {
+      changeState(transition.nextState);
+      return;
+    }
+  }
+}
+
+void TableDurationFsm::readTransition(byte state, DurationTransition &transition) const {
+  memcpy_P(&transition, &transitions[state], sizeof(DurationTransition));
+}
+//END TABLE DURATION FSM
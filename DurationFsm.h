@@ -4,18 +4,25 @@
 
 #include "Arduino.h"
 #include "FiniteStateMachine.h"
+#include "RunStats.h"
 
 #define LIBCALL_DEEP_SLEEP_SCHEDULER
 #include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
 
 #define INFINITE_DURATION 0
+// events a TableDurationFsm can hold until they are dispatched
+#define FSM_EVENT_QUEUE_SIZE 4
+// state of an EventTransition that matches in every state
+#define ANY_STATE 254
+// guard of an EventTransition that always passes
+#define NO_GUARD 0
 
 //define the functionality of the states
 class DurationState: public State {
   public:
-    DurationState(const unsigned long minDurationMs, String name): State(name), minDurationMs(minDurationMs), nextState(NULL) {
+    DurationState(const unsigned long minDurationMs, const __FlashStringHelper *name): State(name), minDurationMs(minDurationMs), nextState(NULL) {
     }
-    DurationState(const unsigned long minDurationMs, String name, SuperState * const superState): State(name, superState), minDurationMs(minDurationMs), nextState(NULL) {
+    DurationState(const unsigned long minDurationMs, const __FlashStringHelper *name, SuperState * const superState): State(name, superState), minDurationMs(minDurationMs), nextState(NULL) {
     }
     unsigned long minDurationMs;
     // nextState as NULL marks a state that is not changed when calling changeToNextStateIfElapsed(). minDurationMs is ignored in that case.
@@ -25,7 +32,7 @@ class DurationState: public State {
 //define the finite state machine functionality
 class DurationFsm: FiniteStateMachine, Runnable {
   public:
-    DurationFsm(DurationState& current, String name);
+    DurationFsm(DurationState& current, const __FlashStringHelper *name);
     virtual ~DurationFsm() {};
 
     // Call this method when not using the scheduler. It changes to the next state immediatelly and returns the new state.
@@ -43,5 +50,140 @@ class DurationFsm: FiniteStateMachine, Runnable {
     void run();
 };
 
+#define NO_NEXT_STATE 255
+
+/**
+   One row of the transition table of a TableDurationFsm. The table is indexed by state number and meant to be stored in PROGMEM.
+*/
+struct DurationTransition {
+  // name of the state, must point to a PROGMEM string
+  const char *name;
+  // NO_NEXT_STATE marks a state that is not changed when calling immediatelyChangeToNextState(). minDurationMs is ignored in that case.
+  byte nextState;
+  unsigned long minDurationMs;
+};
+
+/**
+   Transition of a TableDurationFsm triggered by an event instead of the time.
+   The first entry matching the current state and the event whose guard passes is taken.
+*/
+struct EventTransition {
+  // the state the transition starts from or ANY_STATE
+  byte state;
+  byte event;
+  // passed to DurationTransitionListener::checkGuard() unless NO_GUARD
+  byte guard;
+  byte nextState;
+};
+
+/**
+   Receives the state changes of a TableDurationFsm. One listener replaces the virtual enter()/exit() methods of all state objects.
+*/
+class DurationTransitionListener {
+  public:
+    virtual void exitState(byte state) = 0;
+    virtual void enterState(byte state) = 0;
+    /**
+       Allows durations only known at runtime, e.g. read from EEPROM.
+       @param tableDurationMs the minDurationMs from the transition table
+    */
+    virtual unsigned long getMinDurationMs(byte state, unsigned long tableDurationMs) {
+      return tableDurationMs;
+    }
+    /**
+       Allows to choose the next state at runtime, e.g. to repeat a sequence of states.
+       @param tableNextState the nextState from the transition table, never NO_NEXT_STATE
+    */
+    virtual byte getNextState(byte state, byte tableNextState) {
+      return tableNextState;
+    }
+    /**
+       Decides if an event transition with the given guard is taken.
+    */
+    virtual bool checkGuard(byte guard) {
+      return true;
+    }
+};
+
+/**
+   A DurationFsm whose states are plain numbers and whose transitions are read from a constant table.
+   It does not need any state objects on the heap.
+*/
+class TableDurationFsm: public Runnable, public FsmTraceSource {
+  public:
+    /**
+       The initial state is set without calling the listener.
+       @param transitions transition table in PROGMEM, indexed by state
+       @param eventTransitions table in PROGMEM of the transitions triggered by postEvent(), in order of priority
+    */
+    TableDurationFsm(const DurationTransition *transitions, byte initialState, DurationTransitionListener *listener, const __FlashStringHelper *name,
+                     const EventTransition *eventTransitions = NULL, byte eventTransitionCount = 0);
+
+    // Changes to the next state immediatelly and returns the new state.
+    // If the current state is the last state, it does not change state and returns the current state.
+    byte immediatelyChangeToNextState();
+    TableDurationFsm& changeState(byte state);
+    /**
+       Exits and enters the current state again and restarts its duration.
+    */
+    TableDurationFsm& reenterState();
+    /**
+       Queues the event to be dispatched by the scheduler. Can be called from an interrupt.
+       An event without matching transition in the current state is dropped, as well as
+       the queued events when the state changes before they are dispatched.
+       @return false if the queue was full and the event is lost
+    */
+    bool postEvent(byte event);
+
+    inline byte getCurrentState() const {
+      return currentState;
+    }
+    inline boolean isInState(byte state) const {
+      return currentState == state;
+    }
+    const __FlashStringHelper *getStateName(byte state) const;
+
+    unsigned long timeInCurrentState();
+
+    // method from Runnable
+    void run();
+    // methods from FsmTraceSource
+    const __FlashStringHelper *getTraceName() const;
+    const __FlashStringHelper *getTraceStateName(byte state) const;
+  private:
+    const DurationTransition * const transitions;
+    DurationTransitionListener * const listener;
+    const __FlashStringHelper * const name;
+    const byte traceSource;
+    byte currentState;
+    unsigned long stateChangeTime;
+
+    const EventTransition * const eventTransitions;
+    const byte eventTransitionCount;
+    volatile byte events[FSM_EVENT_QUEUE_SIZE];
+    volatile byte eventsFirst;
+    volatile byte eventsCount;
+    /**
+      All events are dispatched by this Runnable so that the time based transitions can be cancelled independently.
+    */
+    class EventDispatcher: public Runnable {
+      public:
+        EventDispatcher(TableDurationFsm &fsm): fsm(fsm) {}
+        void run() {
+          MEASURE_RUN(RUN_STATS_FSM_EVENTS);
+          fsm.dispatchEvents();
+        }
+      private:
+        TableDurationFsm &fsm;
+    };
+    EventDispatcher eventDispatcher;
+    void dispatchEvents();
+    void handleEvent(byte event);
+
+    void readTransition(byte state, DurationTransition &transition) const;
+    void scheduleNextState(byte state);
+    void switchState(byte state);
+};
+
 #endif
 
@@ -1,36 +1,32 @@
 
 #include "FiniteStateMachine.h"
+#include "FsmTrace.h"
+
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
 
 //FINITE STATE MACHINE
-FiniteStateMachine::FiniteStateMachine(State& current, const String name): name(name) {
+FiniteStateMachine::FiniteStateMachine(State& current, const __FlashStringHelper *name)
+  : name(name), traceSource(fsmTrace.addSource(this)), traceStateNameCount(0) {
   currentState = &current;
   currentState->enter();
-  stateChangeTime = millis();
+  stateChangeTime = scheduler.getMillis();
 }
 
 FiniteStateMachine& FiniteStateMachine::changeState(State& state) {
   if (currentState != &state) {
     currentState->exit();
 
-    Serial.print(name);
-    Serial.print(F(": changeState: "));
-    Serial.print(currentState->name);
-    Serial.print(F(" -> "));
-    Serial.print(state.name);
+    fsmTrace.record(traceSource, getTraceStateId(currentState->name), getTraceStateId(state.name));
 
     boolean differentSuperStates = currentState->superState != state.superState;
+    if (differentSuperStates) {
+      fsmTrace.record(traceSource,
+                      getTraceStateId(currentState->superState != NULL ? currentState->superState->name : NULL),
+                      getTraceStateId(state.superState != NULL ? state.superState->name : NULL));
+    }
     if (differentSuperStates && currentState->superState != NULL) {
-      Serial.print(F(", SUPER: "));
-      Serial.print(currentState->superState->name);
-      Serial.print(F(" -> "));
-      if (state.superState != NULL) {
-        Serial.print(state.superState->name);
-      }
-      Serial.println();
-
       currentState->superState->exit();
-    } else {
-      Serial.println();
     }
 
     currentState = &state;
@@ -38,7 +34,7 @@ FiniteStateMachine& FiniteStateMachine::changeState(State& state) {
       currentState->superState->enter();
     }
     currentState->enter();
-    stateChangeTime = millis();
+    stateChangeTime = scheduler.getMillis();
   }
   return *this;
 }
@@ -58,6 +54,31 @@ boolean FiniteStateMachine::isInState(SuperState& superState) const {
 }
 
 unsigned long FiniteStateMachine::timeInCurrentState() {
-  return millis() - stateChangeTime;
+  return scheduler.getMillis() - stateChangeTime;
+}
+
+const __FlashStringHelper *FiniteStateMachine::getTraceName() const {
+  return name;
+}
+
+const __FlashStringHelper *FiniteStateMachine::getTraceStateName(byte state) const {
+  return state < traceStateNameCount ? traceStateNames[state] : NULL;
+}
+
+byte FiniteStateMachine::getTraceStateId(const __FlashStringHelper *stateName) {
+  if (stateName == NULL) {
+    return FSM_TRACE_NO_STATE;
+  }
+  for (byte i = 0; i < traceStateNameCount; i++) {
+    if (traceStateNames[i] == stateName) {
+      return i;
+    }
+  }
+  if (traceStateNameCount >= FSM_TRACE_STATE_NAMES) {
+    // printed as unknown state
+    return FSM_TRACE_STATE_NAMES;
+  }
+  traceStateNames[traceStateNameCount] = stateName;
+  return traceStateNameCount++;
 }
 //END FINITE STATE MACHINE
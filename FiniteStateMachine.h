@@ -3,35 +3,39 @@
 #define FINITESTATEMACHINE_H
 
 #include "Arduino.h"
+#include "FsmTrace.h"
+
+// names of states and super states a FiniteStateMachine can resolve in the FSM trace
+#define FSM_TRACE_STATE_NAMES 4
 
 //define the functionality of the states
 class SuperState {
   public:
-    SuperState(String name): name(name) {
+    SuperState(const __FlashStringHelper *name): name(name) {
     }
     virtual ~SuperState() {}
     virtual void enter() {}
     virtual void exit() {}
-    const String name;
+    const __FlashStringHelper * const name;
 };
 
 class State {
   public:
-    State(String name): name(name), superState(NULL) {
+    State(const __FlashStringHelper *name): name(name), superState(NULL) {
     }
-    State(String name, SuperState *const superState): name(name), superState(superState) {
+    State(const __FlashStringHelper *name, SuperState *const superState): name(name), superState(superState) {
     }
     virtual ~State() {}
     virtual void enter() {}
     virtual void exit() {}
-    const String name;
+    const __FlashStringHelper * const name;
     SuperState * const superState;
 };
 
 //define the finite state machine functionality
-class FiniteStateMachine {
+class FiniteStateMachine: public FsmTraceSource {
   public:
-    FiniteStateMachine(State& current, String name);
+    FiniteStateMachine(State& current, const __FlashStringHelper *name);
 
     FiniteStateMachine& changeState(State& state);
 
@@ -41,12 +45,20 @@ class FiniteStateMachine {
 
     unsigned long timeInCurrentState();
 
+    // methods from FsmTraceSource
+    const __FlashStringHelper *getTraceName() const;
+    const __FlashStringHelper *getTraceStateName(byte state) const;
+
   protected:
     unsigned long stateChangeTime;
 
   private:
     State* currentState;
-    const String name;
+    const __FlashStringHelper * const name;
+    const byte traceSource;
+    const __FlashStringHelper *traceStateNames[FSM_TRACE_STATE_NAMES];
+    byte traceStateNameCount;
+    byte getTraceStateId(const __FlashStringHelper *stateName);
 };
 
 #endif
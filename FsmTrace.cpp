@@ -0,0 +1,74 @@
+
+#include "FsmTrace.h"
+#include <util/atomic.h>
+
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+
+FsmTrace fsmTrace;
+
+byte FsmTrace::addSource(FsmTraceSource *source) {
+  if (sourceCount >= FSM_TRACE_MAX_SOURCES) {
+    return FSM_TRACE_NO_SOURCE;
+  }
+  sources[sourceCount] = source;
+  return sourceCount++;
+}
+
+void FsmTrace::record(byte source, byte fromState, byte toState) {
+  const unsigned long timeMs = scheduler.getMillis();
+  // keeps interrupts disabled if called from an ISR
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    FsmTraceRecord &record = records[next];
+    record.timeMs = timeMs;
+    record.source = source;
+    record.fromState = fromState;
+    record.toState = toState;
+    next = (next + 1) % FSM_TRACE_SIZE;
+    if (count < FSM_TRACE_SIZE) {
+      count++;
+    }
+  }
+}
+
+void FsmTrace::printTrace() {
+  noInterrupts();
+  const byte first = (next + FSM_TRACE_SIZE - count) % FSM_TRACE_SIZE;
+  const byte printCount = count;
+  interrupts();
+
+  Serial.print(F("FSM trace: "));
+  Serial.println(printCount);
+  for (byte i = 0; i < printCount; i++) {
+    FsmTraceRecord record;
+    noInterrupts();
+    record = records[(first + i) % FSM_TRACE_SIZE];
+    interrupts();
+    Serial.print(record.timeMs);
+    Serial.print(F(" "));
+    const FsmTraceSource *source = record.source < sourceCount ? sources[record.source] : NULL;
+    if (source != NULL) {
+      Serial.print(source->getTraceName());
+    } else {
+      Serial.print(F("?"));
+    }
+    Serial.print(F(": "));
+    printStateName(source, record.fromState);
+    Serial.print(F(" -> "));
+    printStateName(source, record.toState);
+    Serial.println();
+  }
+}
+
+void FsmTrace::printStateName(const FsmTraceSource *source, byte state) {
+  if (state == FSM_TRACE_NO_STATE) {
+    Serial.print(F("-"));
+    return;
+  }
+  const __FlashStringHelper *name = source != NULL ? source->getTraceStateName(state) : NULL;
+  if (name != NULL) {
+    Serial.print(name);
+  } else {
+    Serial.print(F("?"));
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef FSM_TRACE_H
+#define FSM_TRACE_H
+
+#include "Arduino.h"
+
+#define FSM_TRACE_SIZE 16
+// state machines that can be registered with the trace, the mode FSM and the valve FSM
+#define FSM_TRACE_MAX_SOURCES 2
+// id of a state machine that could not be registered
+#define FSM_TRACE_NO_SOURCE 255
+// state id that stands for no (super) state
+#define FSM_TRACE_NO_STATE 255
+
+/**
+   A state machine whose state changes are recorded. Resolves the ids of a record to names when the trace is printed.
+*/
+class FsmTraceSource {
+  public:
+    virtual ~FsmTraceSource() {}
+    /**
+       @return the name of the state machine as PROGMEM string
+    */
+    virtual const __FlashStringHelper *getTraceName() const = 0;
+    /**
+       @return the name of the state as PROGMEM string or NULL if the id is unknown
+    */
+    virtual const __FlashStringHelper *getTraceStateName(byte state) const = 0;
+};
+
+/**
+   One state change. Only ids are stored, the names are resolved by printTrace().
+*/
+struct FsmTraceRecord {
+  unsigned long timeMs;
+  byte source;
+  byte fromState;
+  byte toState;
+};
+
+/**
+   Ring buffer of the latest state changes of all state machines.
+   Recording does not print anything so that state changes do not wait for the serial port.
+*/
+class FsmTrace {
+  public:
+    FsmTrace(): next(0), count(0), sourceCount(0) {}
+    /**
+       Registers a state machine, meant to be called once from its constructor.
+       @return the id to pass to record() or FSM_TRACE_NO_SOURCE if FSM_TRACE_MAX_SOURCES are registered already
+    */
+    byte addSource(FsmTraceSource *source);
+    /**
+       Adds a state change, overwrites the oldest one if full. Can be called from an ISR.
+       @param fromState, toState ids resolved by FsmTraceSource::getTraceStateName() or FSM_TRACE_NO_STATE
+    */
+    void record(byte source, byte fromState, byte toState);
+    /**
+       Prints all recorded state changes to serial, oldest first.
+    */
+    void printTrace();
+  private:
+    FsmTraceRecord records[FSM_TRACE_SIZE];
+    byte next;
+    byte count;
+    FsmTraceSource *sources[FSM_TRACE_MAX_SOURCES];
+    byte sourceCount;
+    void printStateName(const FsmTraceSource *source, byte state);
+};
+
+extern FsmTrace fsmTrace;
+
+#endif
+
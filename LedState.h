@@ -3,13 +3,14 @@
 #define LED_STATE_H
 
 #include "DurationFsm.h"
+#include "RunStats.h"
 
 class ColorLedState: public DurationState, public Runnable {
   public:
-    ColorLedState(byte greenValue, byte redValue, byte blueValue, unsigned long minDurationMs, unsigned long ledOnDurationMs, String name)
+    ColorLedState(byte greenValue, byte redValue, byte blueValue, unsigned long minDurationMs, unsigned long ledOnDurationMs, const __FlashStringHelper *name)
       : DurationState(minDurationMs, name), greenValue(greenValue), redValue(redValue), blueValue(blueValue), ledOnDurationMs(ledOnDurationMs) {
     }
-    ColorLedState(byte greenValue, byte redValue, byte blueValue, unsigned long minDurationMs, unsigned long ledOnDurationMs, String name, SuperState * const superState)
+    ColorLedState(byte greenValue, byte redValue, byte blueValue, unsigned long minDurationMs, unsigned long ledOnDurationMs, const __FlashStringHelper *name, SuperState * const superState)
       : DurationState(minDurationMs, name, superState), greenValue(greenValue), redValue(redValue), blueValue(blueValue), ledOnDurationMs(ledOnDurationMs) {
     }
     virtual void enter() {
@@ -45,6 +46,7 @@ class ColorLedState: public DurationState, public Runnable {
 #endif
     }
     void run() {
+      MEASURE_RUN(RUN_STATS_COLOR_LED);
       deactivateLed();
     }
     bool isActive() {
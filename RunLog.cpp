@@ -0,0 +1,200 @@
+
+#include "RunLog.h"
+#include <EEPROM.h>
+#include <DS3232RTC.h>    // http://github.com/JChristensen/DS3232RTC
+
+#define EMPTY_SEQUENCE 255
+#define MAX_DELTA_MINUTES 65535UL
+
+static_assert(RUN_LOG_START + RUN_LOG_LENGTH <= E2END + 1, "RUN_LOG_LENGTH does not fit into the EEPROM after EEPROM_LENGTH_TO_USE");
+static_assert(RUN_LOG_SLOT_COUNT >= 2 && RUN_LOG_SLOT_COUNT < EMPTY_SEQUENCE, "RUN_LOG_LENGTH does not fit the amount of slots");
+
+RunLog runLog;
+
+void RunLog::begin() {
+  RunLogAnchor anchor;
+  EEPROM.get(RUN_LOG_START, anchor);
+  if (anchor.version != RUN_LOG_VERSION) {
+    clear();
+    return;
+  }
+
+  // the latest record is the last one whose follower does not continue the sequence
+  latestSlot = RUN_LOG_SLOT_COUNT;
+  byte previousSequence = EMPTY_SEQUENCE;
+  for (byte slot = 0; slot < RUN_LOG_SLOT_COUNT; slot++) {
+    const byte sequence = EEPROM.read(getSlotAddress(slot));
+    if (sequence == EMPTY_SEQUENCE || (slot > 0 && sequence != (previousSequence + 1) % EMPTY_SEQUENCE)) {
+      break;
+    }
+    latestSlot = slot;
+    previousSequence = sequence;
+  }
+
+  latestStartMinutes = anchor.minutes;
+  if (latestSlot != RUN_LOG_SLOT_COUNT) {
+    for (byte slot = 1; slot <= latestSlot; slot++) {
+      RunLogRecord record;
+      readRecord(slot, record);
+      latestStartMinutes += record.deltaMinutes;
+    }
+  }
+}
+
+void RunLog::clear() {
+  for (byte slot = 0; slot < RUN_LOG_SLOT_COUNT; slot++) {
+    EEPROM.update(getSlotAddress(slot), EMPTY_SEQUENCE);
+  }
+  RunLogAnchor anchor;
+  anchor.version = RUN_LOG_VERSION;
+  anchor.minutes = 0;
+  EEPROM.put(RUN_LOG_START, anchor);
+  latestSlot = RUN_LOG_SLOT_COUNT;
+}
+
+void RunLog::startRun() {
+  running = true;
+  currentStartMinutes = getCurrentMinutes();
+  memset(&current, 0, sizeof(RunLogRecord));
+}
+
+void RunLog::addZone(byte zoneIndex, unsigned long pulses, unsigned long durationMs) {
+  if (!running || zoneIndex >= ZONE_COUNT) {
+    return;
+  }
+  RunLogZone &zone = current.zones[zoneIndex];
+  const unsigned long duration = zone.duration + (durationMs / 1000UL + RUN_LOG_DURATION_UNIT_SEC / 2) / RUN_LOG_DURATION_UNIT_SEC;
+  zone.duration = duration > 255 ? 255 : duration;
+  const unsigned long pulseUnits = zone.pulses + (pulses + RUN_LOG_PULSE_UNIT / 2) / RUN_LOG_PULSE_UNIT;
+  zone.pulses = pulseUnits > 65535UL ? 65535U : pulseUnits;
+}
+
+void RunLog::endRun(byte endReason) {
+  if (!running) {
+    return;
+  }
+  running = false;
+
+  byte slot;
+  if (latestSlot == RUN_LOG_SLOT_COUNT) {
+    slot = 0;
+    current.sequence = 0;
+    current.deltaMinutes = 0;
+  } else {
+    slot = (latestSlot + 1) % RUN_LOG_SLOT_COUNT;
+    current.sequence = (EEPROM.read(getSlotAddress(latestSlot)) + 1) % EMPTY_SEQUENCE;
+    const unsigned long deltaMinutes = currentStartMinutes - latestStartMinutes;
+    current.deltaMinutes = deltaMinutes > MAX_DELTA_MINUTES ? MAX_DELTA_MINUTES : deltaMinutes;
+  }
+  current.endReason = endReason;
+  EEPROM.put(getSlotAddress(slot), current);
+  if (slot == 0) {
+    // once per round through the slots
+    RunLogAnchor anchor;
+    anchor.version = RUN_LOG_VERSION;
+    anchor.minutes = currentStartMinutes;
+    EEPROM.put(RUN_LOG_START, anchor);
+  }
+  latestSlot = slot;
+  latestStartMinutes = currentStartMinutes;
+}
+
+void RunLog::printLog() {
+  if (latestSlot == RUN_LOG_SLOT_COUNT) {
+    Serial.println(F("Run log: empty"));
+    return;
+  }
+  const byte oldestSlot = getOldestSlot();
+  const byte count = getCount();
+
+  // go back from the latest start time to the oldest one
+  unsigned long minutes = latestStartMinutes;
+  RunLogRecord record;
+  for (byte slot = latestSlot; slot != oldestSlot; slot = (slot + RUN_LOG_SLOT_COUNT - 1) % RUN_LOG_SLOT_COUNT) {
+    readRecord(slot, record);
+    minutes -= record.deltaMinutes;
+  }
+
+  Serial.print(F("Run log: "));
+  Serial.print(count);
+  Serial.print(F(" of "));
+  Serial.println(RUN_LOG_SLOT_COUNT);
+  for (byte i = 0; i < count; i++) {
+    const byte slot = (oldestSlot + i) % RUN_LOG_SLOT_COUNT;
+    readRecord(slot, record);
+    if (i > 0) {
+      minutes += record.deltaMinutes;
+    }
+    const time_t time = minutes * 60UL;
+    Serial.print(year(time));
+    Serial.print(F("-"));
+    Serial.print(month(time));
+    Serial.print(F("-"));
+    Serial.print(day(time));
+    Serial.print(F(" "));
+    Serial.print(hour(time));
+    Serial.print(minute(time) < 10 ? F(":0") : F(":"));
+    Serial.print(minute(time));
+    if (record.deltaMinutes == MAX_DELTA_MINUTES) {
+      Serial.print(F("?"));
+    }
+    Serial.print(F(", end: "));
+    Serial.print(record.endReason);
+    for (byte zone = 0; zone < ZONE_COUNT; zone++) {
+      if (record.zones[zone].duration > 0 || record.zones[zone].pulses > 0) {
+        Serial.print(F(", zone"));
+        Serial.print(zone + 1);
+        Serial.print(F(": "));
+        Serial.print((unsigned long) record.zones[zone].duration * RUN_LOG_DURATION_UNIT_SEC);
+        Serial.print(F(" s, "));
+        Serial.print((unsigned long) record.zones[zone].pulses * RUN_LOG_PULSE_UNIT);
+        Serial.print(F(" pulses"));
+      }
+    }
+    Serial.println();
+  }
+  Serial.println(F("end: 0 completed, 1 manual, 2 threshold, 3 leak, 4 no water meter, 5 flow deviation"));
+}
+
+byte RunLog::getCount() {
+  if (latestSlot == RUN_LOG_SLOT_COUNT) {
+    return 0;
+  }
+  return (latestSlot + RUN_LOG_SLOT_COUNT - getOldestSlot()) % RUN_LOG_SLOT_COUNT + 1;
+}
+
+bool RunLog::getRecord(byte index, RunLogRecord &record, unsigned long &startMinutes) {
+  if (index >= getCount()) {
+    return false;
+  }
+  const byte recordSlot = (getOldestSlot() + index) % RUN_LOG_SLOT_COUNT;
+  startMinutes = latestStartMinutes;
+  for (byte slot = latestSlot; slot != recordSlot; slot = (slot + RUN_LOG_SLOT_COUNT - 1) % RUN_LOG_SLOT_COUNT) {
+    readRecord(slot, record);
+    startMinutes -= record.deltaMinutes;
+  }
+  readRecord(recordSlot, record);
+  return true;
+}
+
+byte RunLog::getOldestSlot() {
+  // the slot after the latest one holds the oldest record if it is not empty
+  const byte slot = (latestSlot + 1) % RUN_LOG_SLOT_COUNT;
+  if (EEPROM.read(getSlotAddress(slot)) == EMPTY_SEQUENCE) {
+    return 0;
+  }
+  return slot;
+}
+
+void RunLog::readRecord(byte slot, RunLogRecord &record) {
+  EEPROM.get(getSlotAddress(slot), record);
+}
+
+int RunLog::getSlotAddress(byte slot) {
+  return RUN_LOG_START + sizeof(RunLogAnchor) + slot * sizeof(RunLogRecord);
+}
+
+unsigned long RunLog::getCurrentMinutes() {
+  // read from the RTC directly as the system time does not advance while sleeping
+  return RTC.get() / 60UL;
+}
@@ -0,0 +1,106 @@
+#ifndef RUN_LOG_H
+#define RUN_LOG_H
+
+#include "Arduino.h"
+#include "Zones.h"
+#include "Constants.h"
+
+// increase if RunLogRecord changes, the log is cleared then
+#define RUN_LOG_VERSION 1
+// resolution of the stored zone values
+#define RUN_LOG_DURATION_UNIT_SEC 16
+#define RUN_LOG_PULSE_UNIT 16
+
+// why a run ended
+#define RUN_END_COMPLETED 0
+#define RUN_END_MANUAL 1
+#define RUN_END_THRESHOLD 2
+#define RUN_END_LEAK 3
+#define RUN_END_NO_WATER_METER 4
+#define RUN_END_FLOW_DEVIATION 5
+
+struct RunLogZone {
+  // in RUN_LOG_DURATION_UNIT_SEC, saturates at 255
+  byte duration;
+  // in RUN_LOG_PULSE_UNIT, saturates at 65535
+  unsigned int pulses;
+};
+
+/**
+   One watering run as stored in EEPROM.
+*/
+struct RunLogRecord {
+  // increments by one per record modulo 255, 255 marks an empty slot
+  byte sequence;
+  // minutes since the start of the previous record, saturates at 65535
+  unsigned int deltaMinutes;
+  byte endReason;
+  RunLogZone zones[ZONE_COUNT];
+};
+
+/**
+   Start time of the record in the first slot, written when the first slot is written.
+   The times of all other records are calculated from it with the deltas.
+*/
+struct RunLogAnchor {
+  byte version;
+  unsigned long minutes;
+};
+
+#define RUN_LOG_SLOT_COUNT ((RUN_LOG_LENGTH - sizeof(RunLogAnchor)) / sizeof(RunLogRecord))
+
+/**
+   Ring of the latest watering runs in the EEPROM after EEPROMwl. Every run is appended with one write of one record
+   into the next slot, so the writes are spread over all slots.
+*/
+class RunLog {
+  public:
+    RunLog(): running(false) {}
+    /**
+       finds the latest record, clears the log if RUN_LOG_VERSION changed.
+    */
+    void begin();
+    void startRun();
+    /**
+       adds water used and time watered of a zone to the current run. Can be called several times per zone.
+       @param zoneIndex 0 to ZONE_COUNT - 1
+    */
+    void addZone(byte zoneIndex, unsigned long pulses, unsigned long durationMs);
+    /**
+       appends the current run to the log.
+       @param endReason one of RUN_END_*
+    */
+    void endRun(byte endReason);
+    /**
+       returns the amount of records in the log.
+    */
+    byte getCount();
+    /**
+       reads a record and calculates its start time.
+       @param index 0 for the oldest record to getCount() - 1 for the latest one
+       @param startMinutes minutes since 1970 the run started
+       @return false if there is no record with this index
+    */
+    bool getRecord(byte index, RunLogRecord &record, unsigned long &startMinutes);
+    /**
+       prints all records to serial, oldest first.
+    */
+    void printLog();
+  private:
+    RunLogRecord current;
+    bool running;
+    unsigned long currentStartMinutes;
+    // slot of the latest record, RUN_LOG_SLOT_COUNT if empty
+    byte latestSlot;
+    unsigned long latestStartMinutes;
+
+    void clear();
+    byte getOldestSlot();
+    void readRecord(byte slot, RunLogRecord &record);
+    int getSlotAddress(byte slot);
+    unsigned long getCurrentMinutes();
+};
+
+extern RunLog runLog;
+
+#endif
@@ -0,0 +1,84 @@
+
+#include "RunStats.h"
+
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+
+RunStats runStats;
+
+static const char nameWaterMeter[] PROGMEM = "waterMeter";
+static const char nameFsmEvents[] PROGMEM = "fsmEvents";
+static const char nameValveManager[] PROGMEM = "valveManager";
+static const char nameWaterManager[] PROGMEM = "waterManager";
+static const char nameDurationFsm[] PROGMEM = "durationFsm";
+static const char nameColorLed[] PROGMEM = "colorLed";
+static const char nameSerialManager[] PROGMEM = "serialManager";
+static const char nameSerialLog[] PROGMEM = "serialLog";
+static const char nameConfigStore[] PROGMEM = "configStore";
+static const char nameModeButton[] PROGMEM = "modeButton";
+static const char nameStartButton[] PROGMEM = "startButton";
+static const char nameRtc[] PROGMEM = "rtc";
+static const char nameTelemetry[] PROGMEM = "telemetry";
+static const char nameBinaryProtocol[] PROGMEM = "binaryProtocol";
+
+static const char * const names[RUN_STATS_COUNT] PROGMEM = {
+  nameWaterMeter,
+  nameFsmEvents,
+  nameValveManager,
+  nameWaterManager,
+  nameDurationFsm,
+  nameColorLed,
+  nameSerialManager,
+  nameSerialLog,
+  nameConfigStore,
+  nameModeButton,
+  nameStartButton,
+  nameRtc,
+  nameTelemetry,
+  nameBinaryProtocol
+};
+
+RunStats::RunStats() {
+#ifdef RUN_STATS
+  memset(entries, 0, sizeof(entries));
+#endif
+}
+
+void RunStats::add(byte id, unsigned long durationUs) {
+#ifdef RUN_STATS
+  RunStatsEntry &entry = entries[id];
+  entry.count++;
+  const unsigned long totalUs = entry.totalRemainderUs + durationUs;
+  entry.totalMs += totalUs / 1000;
+  entry.totalRemainderUs = totalUs % 1000;
+  if (durationUs > entry.maxUs) {
+    entry.maxUs = durationUs;
+  }
+#endif
+}
+
+void RunStats::printStats() {
+#ifdef RUN_STATS
+  // millis() does not count while in deep sleep, the scheduler time does
+  const unsigned long awakeMs = millis();
+  const unsigned long totalMs = scheduler.getMillis();
+  Serial.print(F("awake: "));
+  Serial.print(awakeMs);
+  Serial.print(F(" ms, deep sleep: "));
+  Serial.print(totalMs - awakeMs);
+  Serial.println(F(" ms"));
+  for (byte i = 0; i < RUN_STATS_COUNT; i++) {
+    const RunStatsEntry &entry = entries[i];
+    Serial.print((const __FlashStringHelper *) pgm_read_ptr(&names[i]));
+    Serial.print(F(": count: "));
+    Serial.print(entry.count);
+    Serial.print(F(", total: "));
+    Serial.print(entry.totalMs);
+    Serial.print(F(" ms, max: "));
+    Serial.print(entry.maxUs);
+    Serial.println(F(" us"));
+  }
+#else
+  Serial.println(F("RUN_STATS not defined in Constants.h"));
+#endif
+}
@@ -0,0 +1,70 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include "Arduino.h"
+#include "Constants.h"
+
+// ids of the measured callbacks, index into the statistics
+#define RUN_STATS_WATER_METER 0
+#define RUN_STATS_FSM_EVENTS 1
+#define RUN_STATS_VALVE_MANAGER 2
+#define RUN_STATS_WATER_MANAGER 3
+#define RUN_STATS_DURATION_FSM 4
+#define RUN_STATS_COLOR_LED 5
+#define RUN_STATS_SERIAL_MANAGER 6
+#define RUN_STATS_SERIAL_LOG 7
+#define RUN_STATS_CONFIG_STORE 8
+#define RUN_STATS_MODE_BUTTON 9
+#define RUN_STATS_START_BUTTON 10
+#define RUN_STATS_RTC 11
+#define RUN_STATS_TELEMETRY 12
+#define RUN_STATS_BINARY_PROTOCOL 13
+#define RUN_STATS_COUNT 14
+
+#ifdef RUN_STATS
+// measures the scheduler callback it is placed in until the end of the enclosing block
+#define MEASURE_RUN(id) RunStatsScope runStatsScope(id)
+#else
+#define MEASURE_RUN(id)
+#endif
+
+struct RunStatsEntry {
+  unsigned long count;
+  unsigned long totalMs;
+  // part of the total below one millisecond
+  unsigned int totalRemainderUs;
+  unsigned long maxUs;
+};
+
+/**
+   Counts how often and how long the scheduler callbacks run and how long the system was awake.
+*/
+class RunStats {
+  public:
+    RunStats();
+    void add(byte id, unsigned long durationUs);
+    /**
+       prints the awake and sleep time and the statistics of all callbacks to serial.
+    */
+    void printStats();
+  private:
+#ifdef RUN_STATS
+    RunStatsEntry entries[RUN_STATS_COUNT];
+#endif
+};
+
+extern RunStats runStats;
+
+class RunStatsScope {
+  public:
+    RunStatsScope(const byte id): id(id), startUs(micros()) {
+    }
+    ~RunStatsScope() {
+      runStats.add(id, micros() - startUs);
+    }
+  private:
+    const byte id;
+    const unsigned long startUs;
+};
+
+#endif
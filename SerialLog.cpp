@@ -0,0 +1,43 @@
+
+#include "SerialLog.h"
+#include "RunStats.h"
+
+SerialLog serialLog;
+
+size_t SerialLog::write(uint8_t value) {
+  const byte nextHead = (head + 1) % SERIAL_LOG_BUFFER_SIZE;
+  if (nextHead == tail) {
+    droppedCount++;
+    return 0;
+  }
+  buffer[head] = value;
+  head = nextHead;
+  if (!draining) {
+    draining = true;
+    scheduler.acquireNoSleepLock();
+    scheduler.schedule(this);
+  }
+  return 1;
+}
+
+void SerialLog::run() {
+  MEASURE_RUN(RUN_STATS_SERIAL_LOG);
+  while (tail != head && Serial.availableForWrite() > 0) {
+    Serial.write(buffer[tail]);
+    tail = (tail + 1) % SERIAL_LOG_BUFFER_SIZE;
+  }
+#ifdef SERIAL_TX_BUFFER_SIZE
+  // also wait for the serial TX buffer so that sleeping does not cut off output
+  const bool serialBufferEmpty = Serial.availableForWrite() >= SERIAL_TX_BUFFER_SIZE - 1;
+#else
+  const bool serialBufferEmpty = true;
+#endif
+  if (tail != head || !serialBufferEmpty) {
+    scheduler.scheduleDelayed(this, SERIAL_LOG_DRAIN_INTERVAL_MS);
+  } else {
+    // only the byte in transmission is left
+    Serial.flush();
+    draining = false;
+    scheduler.releaseNoSleepLock();
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef SERIAL_LOG_H
+#define SERIAL_LOG_H
+
+#include "Arduino.h"
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+
+// must be smaller than 256
+#define SERIAL_LOG_BUFFER_SIZE 64
+#define SERIAL_LOG_DRAIN_INTERVAL_MS 10
+
+/**
+   Buffered serial output for log messages. Printing only copies into a bounded buffer and never waits
+   for the UART, bytes that do not fit are dropped. The buffer is drained to Serial by the scheduler.
+   The system does not sleep while output is pending.
+*/
+class SerialLog: public Print, public Runnable {
+  public:
+    SerialLog(): head(0), tail(0), droppedCount(0), draining(false) {}
+    /**
+       method from Print, copies the byte into the buffer or drops it if the buffer is full.
+    */
+    size_t write(uint8_t value);
+    using Print::write;
+    /**
+       returns true if there is output that was not sent yet.
+    */
+    inline bool isPending() const {
+      return draining;
+    }
+    /**
+       returns the amount of bytes dropped since startup because the buffer was full.
+    */
+    inline unsigned int getDroppedCount() const {
+      return droppedCount;
+    }
+    /**
+       do not call from external, used internally to drain the buffer.
+    */
+    void run();
+  private:
+    byte buffer[SERIAL_LOG_BUFFER_SIZE];
+    byte head;
+    byte tail;
+    unsigned int droppedCount;
+    bool draining;
+};
+
+extern SerialLog serialLog;
+
+#endif
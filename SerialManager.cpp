@@ -1,5 +1,14 @@
 
 #include "SerialManager.h"
+#include "StaticArena.h"
+#include "FsmTrace.h"
+#include "SerialLog.h"
+#include "ConfigStore.h"
+#include "RunStats.h"
+#include "WeeklySchedule.h"
+#include "RunLog.h"
+#include "BinaryProtocol.h"
+#include "Telemetry.h"
 #include <DS3232RTC.h>    // http://github.com/JChristensen/DS3232RTC
 #include <EEPROMWearLevel.h> // https://github.com/PRosenb/EEPROMWearLevel
 
@@ -28,6 +37,12 @@ SerialManager::SerialManager(byte bluetoothEnablePin) :  bluetoothEnablePin(blue
 
 void SerialManager::setWaterManager(WaterManager *waterManager) {
   SerialManager::waterManager = waterManager;
+#ifdef BINARY_PROTOCOL
+  binaryProtocol.setWaterManager(waterManager);
+#endif
+#ifdef TELEMETRY
+  telemetry.setWaterManager(waterManager);
+#endif
 }
 
 void SerialManager::startSerial() {
@@ -35,7 +50,7 @@ void SerialManager::startSerial() {
     digitalWrite(bluetoothEnablePin, HIGH);
   }
 
-  serialLastActiveMillis = millis();
+  serialLastActiveMillis = scheduler.getMillis();
   if (!aquiredWakeLock) {
     aquiredWakeLock = true;
     scheduler.acquireNoSleepLock();
@@ -47,28 +62,91 @@ void SerialManager::startSerial() {
 }
 
 void SerialManager::run() {
-  if (Serial.available() > 0) {
-    serialLastActiveMillis = millis();
-    handleSerialInput();
+  MEASURE_RUN(RUN_STATS_SERIAL_MANAGER);
+  if (aquiredWakeLock) {
+    readInput();
   }
 
-  unsigned long serialSleepTimeoutMs = SERIAL_SLEEP_TIMEOUT_MS_DEFAULT;
-  EEPROMwl.get(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
-  if (millis() - serialLastActiveMillis > serialSleepTimeoutMs) {
+  if (scheduler.getMillis() - serialLastActiveMillis > config.getSerialSleepTimeoutMs()) {
     if (aquiredWakeLock) {
       aquiredWakeLock = false;
       scheduler.releaseNoSleepLock();
-      Serial.println(F("stop serial"));
-      delay(150);
-      if (bluetoothEnablePin != UNDEFINED) {
-        digitalWrite(bluetoothEnablePin, LOW);
-      }
+      serialLog.println(F("stop serial"));
+    }
+    // switch bluetooth off only when all output is sent
+    if (serialLog.isPending()) {
+      scheduler.scheduleDelayed(this, SERIAL_LOG_DRAIN_INTERVAL_MS);
+#ifdef TELEMETRY
+    } else if (bluetoothEnablePin != UNDEFINED && !telemetry.isEnabled()) {
+#else
+    } else if (bluetoothEnablePin != UNDEFINED) {
+#endif
+      digitalWrite(bluetoothEnablePin, LOW);
     }
+  } else if (Serial.available() > 0) {
+    // continue after the other callbacks
+    scheduler.schedule(this);
+#ifdef BINARY_PROTOCOL
+  } else if (lineLength > 0 || binaryProtocol.isReceiving()) {
+#else
+  } else if (lineLength > 0) {
+#endif
+    scheduler.scheduleDelayed(this, SERIAL_POLL_INTERVAL_MS);
   } else {
     scheduler.scheduleDelayed(this, 1000);
   }
 }
 
+void SerialManager::readInput() {
+#ifdef BINARY_PROTOCOL
+  if (binaryProtocol.isReceiving() || (lineLength == 0 && Serial.available() > 0 && Serial.peek() == BINARY_FRAME_DELIMITER)) {
+    if (Serial.available() > 0) {
+      serialLastActiveMillis = scheduler.getMillis();
+    }
+    binaryProtocol.receive();
+    return;
+  }
+#endif
+  // at most one line per call so that a burst of input does not block the other callbacks
+  for (byte i = 0; i <= SERIAL_LINE_LENGTH && Serial.available() > 0; i++) {
+    serialLastActiveMillis = scheduler.getMillis();
+#ifdef BINARY_PROTOCOL
+    if (Serial.peek() == BINARY_FRAME_DELIMITER) {
+      // a binary frame drops the incomplete line
+      lineLength = 0;
+      return;
+    }
+#endif
+    const char value = Serial.read();
+    if (value == '\n' || value == '\r') {
+      if (lineLength > 0) {
+        handleLine();
+        return;
+      }
+    } else if (lineLength < SERIAL_LINE_LENGTH) {
+      line[lineLength++] = value;
+    } else {
+      // too long, rejected when the line ends
+      lineLength = SERIAL_LINE_LENGTH + 1;
+    }
+  }
+  // a line without line ending is handled once no more input arrives
+  if (lineLength > 0 && Serial.available() == 0 && scheduler.getMillis() - serialLastActiveMillis >= SERIAL_LINE_TIMEOUT_MS) {
+    handleLine();
+  }
+}
+
+void SerialManager::handleLine() {
+  if (lineLength > SERIAL_LINE_LENGTH) {
+    Serial.println(F("Line too long"));
+  } else {
+    line[lineLength] = '\0';
+    input = line;
+    handleCommand();
+  }
+  lineLength = 0;
+}
+
 void SerialManager::printTime(time_t t) {
   Serial.print(year(t));
   Serial.print(F("-"));
@@ -88,15 +166,15 @@ void SerialManager::printTime(time_t t) {
 // sets the system and RTC time.
 // used format: 2016-01-03T16:43
 void SerialManager::handleSetDateTime() {
-  int yearValue = serialReadInt(4);
-  char dash1 = Serial.available() ? Serial.read() : 0;
-  int monthValue = serialReadInt(2);
-  char dash2 = Serial.available() ? Serial.read() : 0;
-  int dayValue = serialReadInt(2);
-  char tsign = Serial.available() ? Serial.read() : 0;
-  int hours = serialReadInt(2);
-  char colon = Serial.available() ? Serial.read() : 0;
-  int minutes = serialReadInt(2);
+  int yearValue = readInt(4);
+  char dash1 = readChar();
+  int monthValue = readInt(2);
+  char dash2 = readChar();
+  int dayValue = readInt(2);
+  char tsign = readChar();
+  int hours = readInt(2);
+  char colon = readChar();
+  int minutes = readInt(2);
   if (colon == ':' && dash1 == '-' && dash2 == '-' && (tsign == 'T' || tsign == ' ')
       && monthValue >= 1 && monthValue <= 12
       && dayValue >= 1 && dayValue <= 31
@@ -108,6 +186,8 @@ void SerialManager::handleSetDateTime() {
     setTime(hours, minutes, 0, dayValue, monthValue, yearValue);
     //set the RTC from the system time
     RTC.set(now());
+    // the next start time is relative to the clock
+    weeklySchedule.programNextAlarm();
   } else {
     Serial.println(F("Wrong format, e.g. use d2016-01-03T16:43"));
   }
@@ -128,58 +208,53 @@ void SerialManager::handleSetDateTime() {
   Serial.println();
 }
 
-void SerialManager::handleSetAlarmTime() {
-  int alarmNr = serialReadInt(1);
-  Serial.read(); // the :
-
-  // + 1 to allow one space for the Null termination
-  char inData[3 + 1];
-  readSerial(inData, 3 + 1);
-  if (strcmp(inData, "off") == 0) {
-    switch (alarmNr) {
-      case 1: {
-          RTC.alarmInterrupt(ALARM_1, false);
-          Serial.println(F("deactivate alarm 1"));
-          break;
-        }
-      case 2: {
-          RTC.alarmInterrupt(ALARM_2, false);
-          Serial.println(F("deactivate alarm 2"));
-          break;
-        }
-      default: {
-          Serial.println(F("wrong alarm number"));
-          break;
-        }
+void SerialManager::handleSchedule() {
+  char subCommand = readChar();
+  if (subCommand == 'l') {
+    weeklySchedule.printSchedule();
+  } else if (subCommand == 'c') {
+    weeklySchedule.clear();
+    Serial.println(F("schedule cleared"));
+  } else if (subCommand == 'd') {
+    int index = readInt(2);
+    if (weeklySchedule.remove(index)) {
+      Serial.print(F("removed start time "));
+      Serial.println(index);
+    } else {
+      Serial.println(F("remove start time failed, wrong number"));
     }
-  } else {
-    inData[2] = '\0'; // Null terminate the string
-    int hours = atoi(inData);
-    int minutes = serialReadInt(2);
-    if (hours >= 0 && hours <= 24 && minutes >= 0 && minutes <= 60 && (alarmNr == 1 || alarmNr == 2)) {
-      //setAlarm(ALARM_TYPES_t alarmType, byte seconds, byte minutes, byte hours, byte daydate);
-      switch (alarmNr) {
-        case 1: {
-            RTC.setAlarm(ALM1_MATCH_HOURS, 0, minutes, hours, 0);
-            RTC.alarmInterrupt(ALARM_1, true);
-            break;
-          }
-        case 2: {
-            RTC.setAlarm(ALM2_MATCH_HOURS, 0, minutes, hours, 0);
-            RTC.alarmInterrupt(ALARM_2, true);
-            break;
-          }
+  } else if (subCommand >= '0' && subCommand <= '7') {
+    const byte weekday = subCommand - '0';
+    readChar(); // the :
+    int hours = readInt(2);
+    readChar(); // the :
+    int minutes = readInt(2);
+    ZoneMask zones = ALL_ZONES;
+    if (peekChar() == ',') {
+      readChar();
+      zones = 0;
+      while (peekChar() >= '0' && peekChar() <= '9') {
+        int zoneNr = readInt(ZONE_COUNT > 9 ? 2 : 1);
+        if (zoneNr >= 1 && zoneNr <= ZONE_COUNT) {
+          zones |= (ZoneMask) 1 << (zoneNr - 1);
+        }
       }
-
-      Serial.print(F("set start time "));
-      Serial.print(alarmNr);
-      Serial.print(F(" to "));
+    }
+    // weekday 0 adds the start time to every day
+    bool added = true;
+    for (byte day = weekday == 0 ? 1 : weekday; day <= (weekday == 0 ? 7 : weekday) && added; day++) {
+      added = weeklySchedule.add(day, hours, minutes, zones);
+    }
+    if (added) {
+      Serial.print(F("added start time "));
       Serial.print(hours);
       Serial.print(F(":"));
       Serial.println(minutes);
     } else {
-      Serial.println(F("set start time failed, wrong format, expect s<hh>:<mm>, e.g. a14:45"));
+      Serial.println(F("add start time failed, schedule full or wrong format, expect a<d>:<hh>:<mm>, e.g. a2:14:45"));
     }
+  } else {
+    Serial.println(F("wrong schedule command"));
   }
 }
 
@@ -253,48 +328,58 @@ void SerialManager::handleGetAlarmTime(byte alarmNumber) {
 #endif // RTC_SUPPORTS_READ_ALARM
 
 void SerialManager::handleStatus() {
-  const byte subCommand = Serial.available() ? Serial.read() : 0;
+  const byte subCommand = readChar();
   if (subCommand == 'e') {
-    Serial.available() ? Serial.read() : 0; // char colon
-    int startAddress = serialReadInt(3);
-    Serial.available() ? Serial.read() : 0; // char comma
-    int endAddress = serialReadInt(3);
+    readChar(); // char colon
+    int startAddress = readInt(3);
+    readChar(); // char comma
+    int endAddress = readInt(3);
     EEPROMwl.printStatus(Serial);
     if (endAddress > 0) {
       EEPROMwl.printBinary(Serial, startAddress, endAddress);
       Serial.println();
     }
+  } else if (subCommand == 't') {
+    fsmTrace.printTrace();
+  } else if (subCommand == 'r') {
+    runStats.printStats();
+  } else if (subCommand == 'l') {
+    runLog.printLog();
   } else {
     Serial.print(F("Startup time: "));
     printTime(startupTime);
     Serial.print(F("Current time: "));
     setSyncProvider(RTC.get);
     printTime(now());
-    int resetCount = 0;
-    EEPROMwl.get(EEPROM_INDEX_WATCHDOG_RESET_COUNT, resetCount);
     Serial.print(F("WD reset count: "));
-    Serial.println(resetCount);
-    unsigned long serialSleepTimeoutMs = SERIAL_SLEEP_TIMEOUT_MS_DEFAULT;
-    EEPROMwl.get(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
+    Serial.println(config.getWatchdogResetCount());
     Serial.print(F("Serial sleep timeout: "));
-    Serial.print(serialSleepTimeoutMs / 1000 / 60);
+    Serial.print(config.getSerialSleepTimeoutMs() / 1000 / 60);
     Serial.println(F(" min"));
+    Serial.print(F("Arena used: "));
+    Serial.print(arena.getUsed());
+    Serial.print(F(" of "));
+    Serial.println(arena.getSize());
+    if (serialLog.getDroppedCount() > 0) {
+      Serial.print(F("Log bytes dropped: "));
+      Serial.println(serialLog.getDroppedCount());
+    }
     waterManager->printStatus();
   }
 }
 
-void SerialManager::handleSerialInput() {
-  char command = Serial.read();
+void SerialManager::handleCommand() {
+  char command = readChar();
   switch (command) {
     case 'd':
       handleSetDateTime();
       break;
     case 'a':
-      handleSetAlarmTime();
+      handleSchedule();
       break;
     case 't':
-      RTC.setAlarm(ALM1_MATCH_SECONDS, 0, 0, 0, 0);
-      Serial.println(F("alarm every minute"));
+      weeklySchedule.programTestAlarm();
+      Serial.println(F("test alarm at the next full minute"));
       break;
 #ifdef RTC_SUPPORTS_READ_ALARM
     case 'g':
@@ -321,11 +406,16 @@ void SerialManager::handleSerialInput() {
       Serial.print(F("Unknown command: "));
       Serial.println(command);
       Serial.println(F("Supported commands:"));
-      Serial.println(F("a1:<hh>:<mm>: set alarm 1 time"));
-      Serial.println(F("a1:off: deactivate alarm 1"));
-      Serial.println(F("a2:<hh>:<mm>: set alarm 2 time"));
-      Serial.println(F("a2:off: deactivate alarm2"));
-      Serial.println(F("t set alarm every minute (for testing)"));
+      Serial.println(F("a<d>:<hh>:<mm>: add start time on weekday d, 1 is Sunday, 0 every day"));
+#if ZONE_COUNT > 9
+      Serial.println(F("a<d>:<hh>:<mm>,<zones 2 digits each>: add start time for some zones"));
+#else
+      Serial.println(F("a<d>:<hh>:<mm>,<zones>: add start time for some zones, e.g. a0:06:30,13"));
+#endif
+      Serial.println(F("al: list start times"));
+      Serial.println(F("ad<nr 2 digits>: delete start time"));
+      Serial.println(F("ac: clear all start times"));
+      Serial.println(F("t set alarm every minute (for testing), replaced by the next start time"));
 #ifdef RTC_SUPPORTS_READ_ALARM
       Serial.println(F("g: get alarm times"));
 #endif // RTC_SUPPORTS_READ_ALARM
@@ -333,22 +423,42 @@ void SerialManager::handleSerialInput() {
       Serial.println(F("m: change mode"));
       Serial.println(F("i: start automatic"));
       Serial.println(F("j: start automatic RTC"));
+#if ZONE_COUNT > 9
+      Serial.println(F("wz<zone 2 digits>:<value 3 digits> write zone duration in minutes"));
+#else
       Serial.println(F("wz<zone>:<value 3 digits> write zone duration in minutes"));
+#endif
+#if ZONE_COUNT > 9
+      Serial.println(F("wv<zone 2 digits>:<value 3 digits> write zone volume in litres, 0 for duration only"));
+#else
+      Serial.println(F("wv<zone>:<value 3 digits> write zone volume in litres, 0 for duration only"));
+#endif
       Serial.println(F("wm:<value 3 digits> write water meter stop threshold"));
       Serial.println(F("ws:<value 3 digits> write serial sleep timeout in minutes"));
+      Serial.println(F("wf forget the learned flow of all zones, e.g. after sprinklers were changed"));
+      Serial.println(F("wi:<value 3 digits> write litres per hour while idle to report a leak, 0 to stop"));
+#ifdef TELEMETRY
+      Serial.println(F("wt:<value 3 digits> send binary telemetry every value * 100 ms, 0 to stop"));
+#endif
       Serial.println(F("s print status"));
       Serial.println(F("se print status of EEPROM"));
       Serial.println(F("se:<from 3 digits>,<to 3 digits> print status of EEPROM"));
+      Serial.println(F("st print FSM transition trace"));
+      Serial.println(F("sr print awake time and runtime of callbacks"));
+      Serial.println(F("sl print the log of the latest runs"));
+#ifdef BINARY_PROTOCOL
+      Serial.println(F("a 0 byte starts a binary frame, see BinaryProtocol.h"));
+#endif
   }
 }
 
 void SerialManager::handleWrite() {
-  char writeType = Serial.read();
+  char writeType = readChar();
   switch (writeType) {
     case 'z': {
-        int zoneNr = serialReadInt(1);
-        Serial.read(); // the :
-        int durationMin = serialReadInt(3);
+        int zoneNr = readInt(ZONE_COUNT > 9 ? 2 : 1);
+        readChar(); // the :
+        int durationMin = readInt(3);
         Serial.print(F("handleWrite: "));
         Serial.print(writeType);
         Serial.print(F(" "));
@@ -359,42 +469,78 @@ void SerialManager::handleWrite() {
         waterManager->setZoneDuration(zoneNr, durationSec);
         break;
       }
+    case 'v': {
+        int zoneNr = readInt(ZONE_COUNT > 9 ? 2 : 1);
+        readChar(); // the :
+        int volumeLitres = readInt(3);
+        Serial.print(F("handleWrite: "));
+        Serial.print(writeType);
+        Serial.print(F(" "));
+        Serial.print(zoneNr);
+        Serial.print(F(" "));
+        Serial.println(volumeLitres);
+        waterManager->setZoneVolume(zoneNr, volumeLitres);
+        break;
+      }
     case 's': {
-        Serial.read(); // the :
-        int serialSleepTimeoutMin = serialReadInt(3);
+        readChar(); // the :
+        int serialSleepTimeoutMin = readInt(3);
         Serial.print(F("serialSleepTimeoutMin: "));
         Serial.println(serialSleepTimeoutMin);
         unsigned long serialSleepTimeoutMs = serialSleepTimeoutMin * 60 * 1000L;
-        EEPROMwl.put(EEPROM_INDEX_SERIAL_SLEEP_TIMEOUT_MS, serialSleepTimeoutMs);
+        config.setSerialSleepTimeoutMs(serialSleepTimeoutMs);
         break;
       }
     case 'm': {
-        Serial.read(); // the :
-        int waterMeterStopThreshold = serialReadInt(3);
+        readChar(); // the :
+        int waterMeterStopThreshold = readInt(3);
         Serial.print(F("waterMeterStopThreshold: "));
         Serial.println(waterMeterStopThreshold);
         waterManager->setWaterMeterStopThreshold(waterMeterStopThreshold);
         break;
       }
+    case 'f':
+      Serial.println(F("zone flows cleared"));
+      config.clearZoneFlows();
+      break;
+    case 'i': {
+        readChar(); // the :
+        int idleLeakLitres = readInt(3);
+        Serial.print(F("idleLeakLitres: "));
+        Serial.println(idleLeakLitres);
+        waterManager->setIdleLeakVolume(idleLeakLitres);
+        break;
+      }
+#ifdef TELEMETRY
+    case 't': {
+        readChar(); // the :
+        int telemetryInterval = readInt(3);
+        Serial.print(F("telemetryIntervalMs: "));
+        Serial.println(telemetryInterval * 100UL);
+        telemetry.setIntervalMs(telemetryInterval * 100UL);
+        break;
+      }
+#endif
   }
 }
 
 // ----------------------------------------------------------------------------------
 // helper
 // ----------------------------------------------------------------------------------
-void SerialManager::readSerial(char inData[], int inDataLength) {
-  byte index = 0;
-  // index + 1 to allow one space for the Null termination
-  for (; Serial.available() > 0 && index + 1 < inDataLength; index++) {
-    inData[index] = Serial.read();
-  }
-  inData[index] = '\0'; // Null terminate the string
+char SerialManager::readChar() {
+  return *input != '\0' ? *input++ : 0;
 }
 
-int SerialManager::serialReadInt(int length) {
-  char inData[length + 1];
-  readSerial(inData, length + 1);
-  return atoi(inData);
+char SerialManager::peekChar() {
+  return *input;
+}
+
+int SerialManager::readInt(byte maxDigits) {
+  int value = 0;
+  for (byte i = 0; i < maxDigits && *input >= '0' && *input <= '9'; i++) {
+    value = value * 10 + (readChar() - '0');
+  }
+  return value;
 }
 
 void SerialManager::printTwoDigits(unsigned int value) {
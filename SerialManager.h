@@ -7,8 +7,13 @@
 #include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
 #include "WaterManager.h"
 
-#define SERIAL_SLEEP_TIMEOUT_MS_DEFAULT 120000
 #define UNDEFINED 255
+// longest command line, longer ones are rejected
+#define SERIAL_LINE_LENGTH 32
+// a line without line ending is handled after this time without input
+#define SERIAL_LINE_TIMEOUT_MS 500
+// while a line or binary frame is incomplete
+#define SERIAL_POLL_INTERVAL_MS 10
 
 class SerialManager: public Runnable {
   public:
@@ -40,13 +45,18 @@ class SerialManager: public Runnable {
     unsigned long serialLastActiveMillis = 0;
     boolean aquiredWakeLock = false;
     time_t startupTime;
+    // the line received so far, commands are handled once it is complete
+    char line[SERIAL_LINE_LENGTH + 1];
+    byte lineLength = 0;
+    // position in line while handling it
+    const char *input;
 
     void printTime(time_t time);
     void handleSetDateTime();
     /**
-       sets the alarm1 time.
+       changes the weekly schedule.
     */
-    void handleSetAlarmTime();
+    void handleSchedule();
 #ifdef RTC_SUPPORTS_READ_ALARM
     /**
        @param alarmNumber identifier of the alarm to print, can be 1 or 2.
@@ -55,10 +65,19 @@ class SerialManager: public Runnable {
 #endif // RTC_SUPPORTS_READ_ALARM
     void handleWrite();
     void handleStatus();
-    void handleSerialInput();
-    // helper methods
-    void readSerial(char inData[], int inDataLength);
-    int serialReadInt(int length);
+    /**
+       reads the available input into line and handles it when it is complete.
+    */
+    void readInput();
+    void handleLine();
+    void handleCommand();
+    // helper methods to parse line
+    char readChar();
+    char peekChar();
+    /**
+       reads up to maxDigits digits, returns 0 if there are none.
+    */
+    int readInt(byte maxDigits);
     void printTwoDigits(unsigned int value);
 };
 
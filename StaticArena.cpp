@@ -0,0 +1,16 @@
+
+#include "StaticArena.h"
+
+StaticArena arena;
+
+void *StaticArena::allocate(size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+  if (used + size > ARENA_SIZE) {
+    // only happens if an object is missing in the size check of WateringSystem.ino.
+    // Stop here instead of running with objects somewhere else, abort() disables interrupts and halts.
+    abort();
+  }
+  void *object = &memory[used];
+  used += size;
+  return object;
+}
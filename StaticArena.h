@@ -0,0 +1,41 @@
+#ifndef STATIC_ARENA_H
+#define STATIC_ARENA_H
+
+#include "Arduino.h"
+#include "Constants.h"
+
+#define ARENA_ALIGNMENT sizeof(void *)
+// size a type uses in the arena including alignment
+#define ARENA_SIZEOF(type) ((sizeof(type) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+/**
+   Fixed size memory for the objects that live as long as the system runs.
+   Objects are created with new (arena) and never deleted. This keeps them off the heap.
+   WateringSystem.ino checks at compile time that ARENA_SIZE is big enough for all of them,
+   allocate() halts the system if it is not.
+*/
+class StaticArena {
+  public:
+    StaticArena(): used(0) {}
+    void *allocate(size_t size);
+    /**
+       returns the amount of bytes used so far. As nothing is freed, this is also the high-water mark.
+    */
+    inline size_t getUsed() const {
+      return used;
+    }
+    inline size_t getSize() const {
+      return ARENA_SIZE;
+    }
+  private:
+    byte memory[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGNMENT)));
+    size_t used;
+};
+
+extern StaticArena arena;
+
+inline void *operator new(size_t size, StaticArena &arena) {
+  return arena.allocate(size);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include "Telemetry.h"
+#include "BinaryProtocol.h"
+#include "WaterManager.h"
+#include "SerialLog.h"
+#include "RunStats.h"
+
+#ifdef TELEMETRY
+
+#ifndef BINARY_PROTOCOL
+#error "TELEMETRY needs BINARY_PROTOCOL in Constants.h"
+#endif
+
+Telemetry telemetry;
+
+void Telemetry::setIntervalMs(unsigned long intervalMs) {
+  if (intervalMs > 0 && intervalMs < TELEMETRY_MIN_INTERVAL_MS) {
+    intervalMs = TELEMETRY_MIN_INTERVAL_MS;
+  }
+  Telemetry::intervalMs = intervalMs;
+  nextFrameMillis = scheduler.getMillis();
+  scheduler.removeCallbacks(this);
+  scheduler.schedule(this);
+}
+
+void Telemetry::run() {
+  MEASURE_RUN(RUN_STATS_TELEMETRY);
+  const unsigned long currentMillis = scheduler.getMillis();
+  if (intervalMs > 0 && (long) (currentMillis - nextFrameMillis) >= 0) {
+    sendFrame();
+    nextFrameMillis = currentMillis + intervalMs;
+  }
+
+#ifdef SERIAL_TX_BUFFER_SIZE
+  // do not sleep before the frame is sent, sleeping would cut it off
+  const bool serialBufferEmpty = Serial.availableForWrite() >= SERIAL_TX_BUFFER_SIZE - 1;
+#else
+  const bool serialBufferEmpty = true;
+#endif
+  if (!serialBufferEmpty) {
+    if (!draining) {
+      draining = true;
+      scheduler.acquireNoSleepLock();
+    }
+    scheduler.scheduleDelayed(this, SERIAL_LOG_DRAIN_INTERVAL_MS);
+    return;
+  }
+  if (draining) {
+    draining = false;
+    scheduler.releaseNoSleepLock();
+  }
+  if (intervalMs > 0) {
+    scheduler.scheduleDelayed(this, nextFrameMillis - currentMillis);
+  }
+}
+
+void Telemetry::sendFrame() {
+  TelemetryFrame frame;
+  memset(&frame, 0, sizeof(TelemetryFrame));
+  frame.uptimeMs = scheduler.getMillis();
+  // millis() does not count while in deep sleep
+  frame.awakeMs = millis();
+  waterManager->getTelemetry(frame);
+
+#ifdef SERIAL_TX_BUFFER_SIZE
+  if (Serial.availableForWrite() < (int) BINARY_FRAME_ENCODED_SIZE(sizeof(TelemetryFrame))) {
+    // dropped, the host sees the gap in the sequence
+    sequence++;
+    return;
+  }
+#endif
+  binaryProtocol.sendFrame(FRAME_TELEMETRY, sequence++, (const byte *) &frame, sizeof(TelemetryFrame));
+}
+
+#endif // TELEMETRY
@@ -0,0 +1,83 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "Arduino.h"
+#define LIBCALL_DEEP_SLEEP_SCHEDULER
+#include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+#include "Constants.h"
+
+#define TELEMETRY_MIN_INTERVAL_MS 100
+
+// values of TelemetryFrame::mode
+#define TELEMETRY_MODE_OFF 0
+#define TELEMETRY_MODE_AUTOMATIC 1
+#define TELEMETRY_MODE_OFF_ONCE 2
+
+// bits of TelemetryFrame::flags
+#define TELEMETRY_FLAG_WATERING 0x01
+#define TELEMETRY_FLAG_THRESHOLD_SUPERVISED 0x02
+#define TELEMETRY_FLAG_STOPPED_BY_THRESHOLD 0x04
+
+/**
+   Data of a FRAME_TELEMETRY frame, little endian without padding as on AVR.
+   Keep tools/telemetry_to_csv.py in sync when it changes.
+*/
+struct TelemetryFrame {
+  // scheduler time including deep sleep
+  unsigned long uptimeMs;
+  // time not in deep sleep
+  unsigned long awakeMs;
+  unsigned long totalPulses;
+  // instantaneous flow in pulses per minute
+  unsigned int flow;
+  // pulses of the window that exceeded the stop threshold, 0 if not stopped by it
+  unsigned int stoppedByThreshold;
+  byte valveState;
+  // first zone of the current group, only valid while watering
+  byte zone;
+  byte mode;
+  byte flags;
+};
+
+class WaterManager;
+
+/**
+   Sends a TelemetryFrame every interval as binary frame. Frames are dropped instead of waiting
+   if the serial TX buffer is too full, the sequence number of the frame shows the gap.
+*/
+class Telemetry: public Runnable {
+  public:
+    Telemetry(): intervalMs(0), sequence(0), draining(false) {}
+    /**
+       @param waterManager the waterManager to read the state from, cannot be null
+    */
+    inline void setWaterManager(WaterManager *waterManager) {
+      Telemetry::waterManager = waterManager;
+    }
+    /**
+       @param intervalMs time between two frames, 0 to stop. Limited to TELEMETRY_MIN_INTERVAL_MS.
+    */
+    void setIntervalMs(unsigned long intervalMs);
+    inline unsigned long getIntervalMs() const {
+      return intervalMs;
+    }
+    inline bool isEnabled() const {
+      return intervalMs > 0;
+    }
+    /**
+       do not call from external, used internally to send the frames.
+    */
+    void run();
+  private:
+    WaterManager *waterManager;
+    unsigned long intervalMs;
+    byte sequence;
+    bool draining;
+    unsigned long nextFrameMillis;
+
+    void sendFrame();
+};
+
+extern Telemetry telemetry;
+
+#endif
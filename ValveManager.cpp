@@ -2,162 +2,435 @@
 #include "ValveManager.h"
 #include <Time.h>         // http://www.arduino.cc/playground/Code/Time
 #include <EEPROMWearLevel.h> // https://github.com/PRosenb/EEPROMWearLevel
+#include "ConfigStore.h"
+
+// state numbers, index into transitions and stateFlags.
+// The states from warn to zone are passed once per zone, see currentZone.
+#define STATE_IDLE 0
+#define STATE_LEAK_CHECK_FILL 1
+#define STATE_LEAK_CHECK_WAIT 2
+#define STATE_WARN 3
+#define STATE_WAIT_BEFORE 4
+#define STATE_ZONE 5
+#define STATE_LEAK 6
+
+// events posted to the fsm by the water meter
+#define EVENT_PULSE_COUNT 1
+#define EVENT_NO_PULSES 2
+
+// guards of the event transitions, see checkGuard()
+#define GUARD_MORE_ZONES 1
+
+// what a state switches and checks
+#define STATE_MAIN_ON 0x01
+#define STATE_LEAK_CHECK 0x02
+// only applies to the first zone of the run
+#define STATE_MEASURE 0x04
+#define STATE_ZONE_VALVE 0x08
+#define STATE_ZONE_RUN 0x10
+
+static const char nameIdle[] PROGMEM = "idle";
+static const char nameLeakCheckFill[] PROGMEM = "leakCheckFill";
+static const char nameLeakCheckWait[] PROGMEM = "leakCheckWait";
+static const char nameWarn[] PROGMEM = "warn";
+static const char nameWaitBefore[] PROGMEM = "waitBefore";
+static const char nameZone[] PROGMEM = "zone";
+static const char nameLeak[] PROGMEM = "leak";
+
+// durations of the zone runs are provided by getMinDurationMs(), the state after the last zone by getNextState()
+static const DurationTransition transitions[] PROGMEM = {
+  {nameIdle, NO_NEXT_STATE, 0},
+  {nameLeakCheckFill, STATE_LEAK_CHECK_WAIT, DURATION_LEAK_CHECK_FILL_MS},
+  {nameLeakCheckWait, STATE_WARN, DURATION_LEAK_CHECK_WAIT_MS},
+  {nameWarn, STATE_WAIT_BEFORE, DURATION_WARN_SEC * 1000UL},
+  {nameWaitBefore, STATE_ZONE, DURATION_WAIT_BEFORE_SEC * 1000UL},
+  {nameZone, STATE_WARN, 0},
+  // stays until stopAll() is called by the leak check listener
+  {nameLeak, NO_NEXT_STATE, 0}
+};
+
+static const EventTransition eventTransitions[] PROGMEM = {
+  // the pipe is full as soon as the water stops flowing
+  {STATE_LEAK_CHECK_FILL, EVENT_NO_PULSES, NO_GUARD, STATE_LEAK_CHECK_WAIT},
+  {STATE_LEAK_CHECK_WAIT, EVENT_PULSE_COUNT, NO_GUARD, STATE_LEAK},
+  // the volume of the zone is reached
+  {STATE_ZONE, EVENT_PULSE_COUNT, GUARD_MORE_ZONES, STATE_WARN},
+  {STATE_ZONE, EVENT_PULSE_COUNT, NO_GUARD, STATE_IDLE}
+};
+
+static const byte stateFlags[] PROGMEM = {
+  0,
+  STATE_MAIN_ON,
+  STATE_MAIN_ON | STATE_LEAK_CHECK,
+  STATE_MAIN_ON | STATE_MEASURE | STATE_ZONE_VALVE,
+  0,
+  STATE_MAIN_ON | STATE_ZONE_VALVE | STATE_ZONE_RUN,
+  0
+};
 
 ValveManager::ValveManager(WaterMeter *waterMeter,
                            MeasureStateListener * const waterMeterCheckListener,
-                           Runnable * const leakCheckListener) {
-  unsigned int durationZone1Sec = DEFAULT_DURATION_AUTOMATIC1_SEC;
-  durationZone1Sec = EEPROMwl.get(EEPROM_INDEX_ZONE1, durationZone1Sec);
-  unsigned int durationZone2Sec = DEFAULT_DURATION_AUTOMATIC2_SEC;
-  durationZone2Sec = EEPROMwl.get(EEPROM_INDEX_ZONE2, durationZone2Sec);
-  unsigned int durationZone3Sec = DEFAULT_DURATION_AUTOMATIC3_SEC;
-  durationZone3Sec = EEPROMwl.get(EEPROM_INDEX_ZONE3, durationZone3Sec);
-
-  // set limit
-  if (durationZone1Sec > MAX_ZONE_DURATION) {
-    durationZone1Sec = MAX_ZONE_DURATION;
-  }
-  if (durationZone2Sec > MAX_ZONE_DURATION) {
-    durationZone2Sec = MAX_ZONE_DURATION;
-  }
-  if (durationZone3Sec > MAX_ZONE_DURATION) {
-    durationZone3Sec = MAX_ZONE_DURATION;
-  }
-
-  valveMain = new MeasuredValve(VALVE1_PIN, waterMeter);
-  valveArea1 = new Valve(VALVE2_PIN);
-  valveArea2 = new Valve(VALVE3_PIN);
-  valveArea3 = new Valve(VALVE4_PIN);
-
-  superStateMainIdle = new SuperState(F("mainIdle"));
-  superStateMainOn = new ValveSuperState(valveMain, F("mainOn"));
-
-  stateIdle = new DurationState(0, F("idle"), superStateMainIdle);
-  stateLeakCheckFill = new DurationState(DURATION_LEAK_CHECK_FILL_MS, F("leakCheckFill"), superStateMainOn);
-  stateLeakCheckWait = new LeakCheckState(DURATION_LEAK_CHECK_WAIT_MS, F("leakCheckWait"), superStateMainOn, leakCheckListener, waterMeter);
-  stateWarnAutomatic1 = new MeasureState(valveArea1, DURATION_WARN_SEC * 1000UL, F("warnArea1"), superStateMainOn, waterMeterCheckListener, waterMeter);
-  stateWaitBeforeAutomatic1 = new DurationState(DURATION_WAIT_BEFORE_SEC * 1000UL, F("idleArea1"), superStateMainIdle);
-  stateAutomatic1 = new ValveState(valveArea1, durationZone1Sec * 1000UL, F("area1"), superStateMainOn);
-  // required to switch main valve off in between. Otherwise, the TaskMeter threashold is hit when filling pipe
-  stateBeforeWarnAutomatic2 = new DurationState(1000UL, F("beforeWarnArea2"), superStateMainIdle);
-  stateWarnAutomatic2 = new ValveState(valveArea2, DURATION_WARN_SEC * 1000UL, F("warnArea2"), superStateMainOn);
-  stateWaitBeforeAutomatic2 = new DurationState(DURATION_WAIT_BEFORE_SEC * 1000UL, F("idleArea2"), superStateMainIdle);
-  stateAutomatic2 = new ValveState(valveArea2, durationZone2Sec * 1000UL, F("area2"), superStateMainOn);
-  // required to switch main valve off in between. Otherwise, the TaskMeter threashold is hit when filling pipe
-  stateBeforeWarnAutomatic3 = new DurationState(1000UL, F("beforeWarnArea3"), superStateMainIdle);
-  stateWarnAutomatic3 = new ValveState(valveArea3, DURATION_WARN_SEC * 1000UL, F("warnArea3"), superStateMainOn);
-  stateWaitBeforeAutomatic3 = new DurationState(DURATION_WAIT_BEFORE_SEC * 1000UL, F("idleArea3"), superStateMainIdle);
-  stateAutomatic3 = new ValveState(valveArea3, durationZone3Sec * 1000UL, F("area3"), superStateMainOn);
-
-  stateLeakCheckFill->nextState = stateLeakCheckWait;
-  stateLeakCheckWait->nextState = stateWarnAutomatic1;
-  stateWarnAutomatic1->nextState = stateWaitBeforeAutomatic1;
-  stateWaitBeforeAutomatic1->nextState = stateAutomatic1;
-  stateAutomatic1->nextState = stateBeforeWarnAutomatic2;
-
-  stateBeforeWarnAutomatic2->nextState = stateWarnAutomatic2;
-  stateWarnAutomatic2->nextState = stateWaitBeforeAutomatic2;
-  stateWaitBeforeAutomatic2->nextState = stateAutomatic2;
-  stateAutomatic2->nextState = stateBeforeWarnAutomatic3;
-
-  stateBeforeWarnAutomatic3->nextState = stateWarnAutomatic3;
-  stateWarnAutomatic3->nextState = stateWaitBeforeAutomatic3;
-  stateWaitBeforeAutomatic3->nextState = stateAutomatic3;
-  stateAutomatic3->nextState = stateIdle;
-
-  fsm = new DurationFsm(*stateIdle, F("FSM"));
-}
-
-ValveManager::~ValveManager() {
-  delete valveMain;
-  delete valveArea1;
-  delete valveArea2;
-  delete valveArea3;
-
-  delete superStateMainIdle;
-  delete superStateMainOn;
-
-  delete stateIdle;
-  delete stateWarnAutomatic1;
-  delete stateWaitBeforeAutomatic1;
-  delete stateAutomatic1;
-  delete stateBeforeWarnAutomatic2;
-  delete stateWarnAutomatic2;
-  delete stateWaitBeforeAutomatic2;
-  delete stateAutomatic2;
-  delete stateBeforeWarnAutomatic3;
-  delete stateWarnAutomatic3;
-  delete stateWaitBeforeAutomatic3;
-  delete stateAutomatic3;
-  delete fsm;
-}
-
-void ValveManager::stopAll() {
-  fsm->changeState(*stateIdle);
+                           Runnable * const leakCheckListener,
+                           Runnable * const flowDeviationListener)
+  : currentZone(0), currentZoneEnd(0), activeZones(ALL_ZONES), runEndReason(RUN_END_COMPLETED), flowBudget(0), flowBandMin(0), flowBandMax(0), waterMeter(waterMeter), waterMeterCheckListener(waterMeterCheckListener), leakCheckListener(leakCheckListener),
+    flowDeviationListener(flowDeviationListener),
+    measuredResult(*this), zoneTimer(*this),
+    fsm(transitions, STATE_IDLE, this, F("FSM"), eventTransitions, sizeof(eventTransitions) / sizeof(EventTransition)) {
+  valveMain = new (arena) MeasuredValve(VALVE1_PIN, waterMeter);
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    pinMode(getZonePin(i), OUTPUT);
+  }
+}
+
+void ValveManager::stopAll(byte endReason) {
+  if (isOn()) {
+    runEndReason = endReason;
+  }
+  fsm.changeState(STATE_IDLE);
   // all off, just to be really sure..
   valveMain->off();
-  valveArea1->off();
-  valveArea2->off();
-  valveArea3->off();
+  allZonesOff();
 }
 
-void ValveManager::startAutomaticWithWarn() {
+void ValveManager::startAutomaticWithWarn(ZoneMask zones) {
+  if ((zones & ALL_ZONES) == 0) {
+    return;
+  }
+  activeZones = zones;
+  // entering STATE_WARN continues with the next active zone from currentZoneEnd
+  currentZone = 0;
+  currentZoneEnd = 0;
 #ifdef LEAK_CHECK
-  fsm->changeState(*stateLeakCheckFill);
+  fsm.changeState(STATE_LEAK_CHECK_FILL);
 #else
-  fsm->changeState(*stateWarnAutomatic1);
+  fsm.changeState(STATE_WARN);
 #endif
 }
 
 void ValveManager::startAutomatic() {
-  if (fsm->isInState(*stateAutomatic1)) {
-    fsm->changeState(*stateAutomatic2);
-  } else if (fsm->isInState(*stateAutomatic2)) {
-    fsm->changeState(*stateAutomatic3);
+  activeZones = ALL_ZONES;
+  if (fsm.isInState(STATE_ZONE)) {
+    // next zone, starting over after the last one
+    currentZone = currentZone + 1 < ZONE_COUNT ? currentZone + 1 : 0;
+    currentZoneEnd = currentZone + 1;
+    fsm.reenterState();
   } else {
-    fsm->changeState(*stateAutomatic1);
+    currentZone = 0;
+    currentZoneEnd = 1;
+    fsm.changeState(STATE_ZONE);
   }
 }
 
 void ValveManager::setZoneDuration(byte zone, unsigned int durationSec) {
-  switch (zone) {
-    case 1:
-      EEPROMwl.put(EEPROM_INDEX_ZONE1, durationSec);
-      stateAutomatic1->minDurationMs = durationSec * 1000UL;
-      break;
-    case 2:
-      EEPROMwl.put(EEPROM_INDEX_ZONE2, durationSec);
-      stateAutomatic2->minDurationMs = durationSec * 1000UL;
-      break;
-    case 3:
-      EEPROMwl.put(EEPROM_INDEX_ZONE3, durationSec);
-      stateAutomatic3->minDurationMs = durationSec * 1000UL;
-      break;
+  config.setZoneDurationSec(zone, durationSec);
+}
+
+void ValveManager::setZoneVolume(byte zone, unsigned int volumeLitres) {
+  config.setZoneVolumeLitres(zone, volumeLitres);
+}
+
+void ValveManager::getTelemetry(TelemetryFrame &frame) {
+  frame.valveState = fsm.getCurrentState();
+  frame.zone = currentZone;
+  if (isOn()) {
+    frame.flags |= TELEMETRY_FLAG_WATERING;
   }
 }
 
 void ValveManager::printStatus() {
-  Serial.print(F("zone1: "));
-  Serial.print(stateAutomatic1->minDurationMs / 1000UL / 60UL);
-  Serial.print(F(" min, zone2: "));
-  Serial.print(stateAutomatic2->minDurationMs / 1000UL / 60UL);
-  Serial.print(F(" min, zone3: "));
-  Serial.print(stateAutomatic3->minDurationMs / 1000UL / 60UL);
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    Serial.print(i == 0 ? F("zone") : F(" min, zone"));
+    Serial.print(i + 1);
+    Serial.print(F(": "));
+    Serial.print(config.getZoneDurationSec(i + 1) / 60U);
+  }
   Serial.println(F(" min"));
 
-  unsigned int value = -1;
-  Serial.print(F("eeprom: zone1: "));
-  Serial.print(EEPROMwl.get(EEPROM_INDEX_ZONE1, value));
-  Serial.print(F(", zone2: "));
-  value = -1;
-  Serial.print(EEPROMwl.get(EEPROM_INDEX_ZONE2, value));
-  Serial.print(F(", zone3: "));
-  value = -1;
-  Serial.print(EEPROMwl.get(EEPROM_INDEX_ZONE3, value));
+  Serial.print(F("volume:"));
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    Serial.print(i == 0 ? F(" zone") : F(" l, zone"));
+    Serial.print(i + 1);
+    Serial.print(F(": "));
+    Serial.print(config.getZoneVolumeLitres(i + 1));
+  }
+  Serial.println(F(" l"));
+
+  Serial.print(F("eeprom:"));
+  ZoneSettingsTable stored;
+  memset(&stored, 0xFF, sizeof(stored));
+  EEPROMwl.get(EEPROM_INDEX_ZONES, stored);
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    Serial.print(i == 0 ? F(" zone") : F(", zone"));
+    Serial.print(i + 1);
+    Serial.print(F(": "));
+    Serial.print(stored.zones[i].durationSec);
+  }
   Serial.println();
+
+  Serial.print(F("flow:"));
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    const ZoneFlow &zoneFlow = config.getZoneFlow(i + 1);
+    Serial.print(i == 0 ? F(" zone") : F(", zone"));
+    Serial.print(i + 1);
+    Serial.print(F(": "));
+    Serial.print(zoneFlow.mean);
+    Serial.print(F("+-"));
+    Serial.print(getZoneFlowTolerance(zoneFlow.mean, zoneFlow.variance));
+    Serial.print(F("/min in "));
+    Serial.print(zoneFlow.runs);
+    Serial.print(F(" runs"));
+  }
+  Serial.print(F(", budget: "));
+  Serial.print(flowBudget);
+  Serial.println(F("/min"));
+
+  if (isOn() && currentZoneEnd > currentZone) {
+    Serial.print(F("current zones: "));
+    Serial.print(currentZone + 1);
+    Serial.print(F(" to "));
+    Serial.println(currentZoneEnd);
+  }
 }
 
 bool ValveManager::isOn() {
-  return !fsm->isInState(*stateIdle);
+  return !fsm.isInState(STATE_IDLE);
+}
+
+byte ValveManager::getNextActiveZone(byte zone) {
+  while (zone < ZONE_COUNT && (activeZones & ((ZoneMask) 1 << zone)) == 0) {
+    zone++;
+  }
+  return zone;
+}
+
+byte ValveManager::getZoneGroupEnd(byte firstZone) {
+  byte end = firstZone + 1;
+#ifdef PARALLEL_ZONES
+  // a zone with unknown flow is watered alone so that its flow can be learned,
+  // one with a volume as the water meter cannot tell the zones apart
+  unsigned long groupFlow = config.getZoneVolumeLitres(firstZone + 1) == 0 ? config.getZoneFlow(firstZone + 1).mean : 0;
+  while (groupFlow > 0 && end < ZONE_COUNT && (activeZones & ((ZoneMask) 1 << end)) && config.getZoneFlow(end + 1).mean > 0
+         && config.getZoneVolumeLitres(end + 1) == 0 && groupFlow + config.getZoneFlow(end + 1).mean <= flowBudget) {
+    groupFlow += config.getZoneFlow(end + 1).mean;
+    end++;
+  }
+#endif
+  return end;
+}
+
+void ValveManager::updateZones() {
+  if (currentZoneEnd - currentZone == 1) {
+    const unsigned int flow = waterMeter->getAveragedFlow();
+    // a flow out of the band is not learned, the zone is stopped as soon as the water meter sees it
+    if (flow > 0 && (flowBandMax == 0 || (flow >= flowBandMin && flow <= flowBandMax))) {
+      ZoneFlow zoneFlow = config.getZoneFlow(currentZone + 1);
+      addZoneFlow(zoneFlow, flow);
+      config.setZoneFlow(currentZone + 1, zoneFlow);
+    }
+    return;
+  }
+
+  // the state lasts as long as the longest zone of the group, switch off the others on time
+  const unsigned long elapsedMs = fsm.timeInCurrentState();
+  const unsigned long longestMs = getMinDurationMs(STATE_ZONE, 0);
+  unsigned long nextMs = 0;
+  bool switchedOff = false;
+  for (byte i = currentZone; i < currentZoneEnd; i++) {
+    const unsigned long durationMs = config.getZoneDurationSec(i + 1) * 1000UL;
+    if (durationMs <= elapsedMs) {
+      switchedOff |= digitalRead(getZonePin(i)) == HIGH;
+      digitalWrite(getZonePin(i), LOW);
+    } else if (durationMs < longestMs && (nextMs == 0 || durationMs < nextMs)) {
+      nextMs = durationMs;
+    }
+  }
+  if (nextMs > 0) {
+    scheduler.scheduleDelayed(&zoneTimer, nextMs - elapsedMs);
+  }
+  if (switchedOff) {
+    // the flow goes down to the one of the remaining zones
+    updateFlowBand();
+    waterMeter->restartThresholdSupervision();
+  }
+}
+
+void ValveManager::updateFlowBand() {
+  flowBandMin = 0;
+  flowBandMax = 0;
+  waterMeter->removeFlowBand();
+  unsigned long mean = 0;
+  unsigned long variance = 0;
+  for (byte i = currentZone; i < currentZoneEnd; i++) {
+    if (digitalRead(getZonePin(i)) == HIGH) {
+      const ZoneFlow &zoneFlow = config.getZoneFlow(i + 1);
+      if (!isZoneFlowLearned(zoneFlow)) {
+        // the stop threshold still applies
+        return;
+      }
+      mean += zoneFlow.mean;
+      variance += zoneFlow.variance;
+    }
+  }
+  if (mean == 0 || mean > 0xFFFF) {
+    return;
+  }
+  const unsigned int tolerance = getZoneFlowTolerance(mean, variance);
+  flowBandMin = mean > tolerance ? mean - tolerance : 0;
+  flowBandMax = mean + tolerance < 0xFFFF ? mean + tolerance : 0xFFFF;
+#ifdef ZONE_FLOW_SUPERVISION
+  waterMeter->setFlowBand(flowBandMin, flowBandMax, flowDeviationListener);
+#endif
+}
+
+void ValveManager::logZones() {
+  const unsigned long elapsedMs = fsm.timeInCurrentState();
+  const unsigned long pulses = waterMeter->getTotalCount() - loggedZoneStartTotalCount;
+  // the water meter cannot tell the zones of a group apart, split by their learned flow
+  unsigned long groupFlow = 0;
+  for (byte i = loggedZone; i < loggedZoneEnd; i++) {
+    groupFlow += config.getZoneFlow(i + 1).mean;
+  }
+  for (byte i = loggedZone; i < loggedZoneEnd; i++) {
+    unsigned long durationMs = config.getZoneDurationSec(i + 1) * 1000UL;
+    if (elapsedMs < durationMs) {
+      durationMs = elapsedMs;
+    }
+    const unsigned long zonePulses = groupFlow > 0 ? pulses * config.getZoneFlow(i + 1).mean / groupFlow : pulses / (loggedZoneEnd - loggedZone);
+    runLog.addZone(i, zonePulses, durationMs);
+  }
+}
+
+void ValveManager::allZonesOff() {
+  for (byte i = 0; i < ZONE_COUNT; i++) {
+    digitalWrite(getZonePin(i), LOW);
+  }
+}
+
+void ValveManager::exitState(byte state) {
+  const byte flags = pgm_read_byte(&stateFlags[state]);
+  if (state == STATE_IDLE) {
+    // pipe drain pulses while the main valve is off between zones are not a leak
+    waterMeter->stopIdleMonitoring();
+    runLog.startRun();
+    runEndReason = RUN_END_COMPLETED;
+  }
+  if (flags & STATE_ZONE_RUN) {
+    waterMeter->removePulseCountEvent();
+    waterMeter->removeFlowBand();
+    flowBandMin = 0;
+    flowBandMax = 0;
+    logZones();
+  }
+  if (flags & STATE_ZONE_VALVE) {
+    scheduler.removeCallbacks(&zoneTimer);
+    // all of them as startAutomatic() changes currentZone before re-entering
+    allZonesOff();
+  }
+  if (state == STATE_LEAK_CHECK_FILL) {
+    waterMeter->removeNoPulsesEvent();
+  }
+  if (flags & STATE_LEAK_CHECK) {
+    waterMeter->removePulseCountEvent();
+  }
+  if ((flags & STATE_MEASURE) && currentZone == getNextActiveZone(0)) {
+    measuredTickCount = waterMeter->getTotalCount() - measureStartTotalCount;
+    scheduler.schedule(&measuredResult);
+  }
+}
+
+void ValveManager::enterState(byte state) {
+  const byte flags = pgm_read_byte(&stateFlags[state]);
+  const bool mainWasOn = valveMain->isOn();
+  // the main valve stays on between two states that both need it
+  if (flags & STATE_MAIN_ON) {
+    valveMain->on();
+  } else {
+    valveMain->off();
+  }
+  if (state == STATE_LEAK_CHECK_FILL) {
+    waterMeter->setNoPulsesEvent(DURATION_LEAK_CHECK_NO_PULSES_MS, &fsm, EVENT_NO_PULSES);
+  }
+  if (flags & STATE_LEAK_CHECK) {
+    leakCheckStartTotalCount = waterMeter->getTotalCount();
+    waterMeter->setPulseCountEvent(leakCheckStartTotalCount + 1, &fsm, EVENT_PULSE_COUNT);
+  }
+  if (state == STATE_LEAK) {
+    scheduler.schedule(leakCheckListener);
+    serialLog.print(F("Leak count: "));
+    serialLog.println(waterMeter->getTotalCount() - leakCheckStartTotalCount);
+  }
+  if (state == STATE_WARN) {
+    currentZone = getNextActiveZone(currentZoneEnd);
+    currentZoneEnd = getZoneGroupEnd(currentZone);
+  }
+  if ((flags & STATE_MEASURE) && currentZone == getNextActiveZone(0)) {
+    measureStartTotalCount = waterMeter->getTotalCount();
+  }
+  if (flags & STATE_ZONE_VALVE) {
+    for (byte i = currentZone; i < currentZoneEnd; i++) {
+      digitalWrite(getZonePin(i), HIGH);
+    }
+    if (mainWasOn) {
+      // the pipe of the new zones fills up, the water meter would see it as overflow otherwise
+      waterMeter->restartThresholdSupervision();
+    }
+  }
+  if (state == STATE_IDLE) {
+    runLog.endRun(runEndReason);
+    waterMeter->startIdleMonitoring();
+  }
+  if (flags & STATE_ZONE_RUN) {
+    loggedZone = currentZone;
+    loggedZoneEnd = currentZoneEnd;
+    loggedZoneStartTotalCount = waterMeter->getTotalCount();
+    updateFlowBand();
+    if (currentZoneEnd - currentZone == 1) {
+      scheduler.scheduleDelayed(&zoneTimer, ZONE_FLOW_SETTLE_MS);
+      const unsigned long volumePulses = config.getZoneVolumeLitres(currentZone + 1) * (unsigned long) WATER_METER_PULSES_PER_LITRE;
+      if (volumePulses > 0) {
+        // the zone duration remains as limit
+        waterMeter->setPulseCountEvent(waterMeter->getTotalCount() + volumePulses, &fsm, EVENT_PULSE_COUNT);
+      }
+    } else {
+      // runs after the state change time is set
+      scheduler.schedule(&zoneTimer);
+    }
+  }
+}
+
+unsigned long ValveManager::getMinDurationMs(byte state, unsigned long tableDurationMs) {
+  const byte flags = pgm_read_byte(&stateFlags[state]);
+  if (flags & STATE_ZONE_RUN) {
+    // the longest zone of the group
+    unsigned long durationMs = 0;
+    for (byte i = currentZone; i < currentZoneEnd; i++) {
+      const unsigned long zoneDurationMs = config.getZoneDurationSec(i + 1) * 1000UL;
+      if (zoneDurationMs > durationMs) {
+        durationMs = zoneDurationMs;
+      }
+    }
+    return durationMs;
+  }
+  return tableDurationMs;
+}
+
+byte ValveManager::getNextState(byte state, byte tableNextState) {
+  if (state == STATE_ZONE && !checkGuard(GUARD_MORE_ZONES)) {
+    return STATE_IDLE;
+  }
+  if (state == STATE_LEAK_CHECK_WAIT && waterMeter->getTotalCount() != leakCheckStartTotalCount) {
+    // pulses whose event was not dispatched yet
+    return STATE_LEAK;
+  }
+  return tableNextState;
+}
+
+bool ValveManager::checkGuard(byte guard) {
+  switch (guard) {
+    case GUARD_MORE_ZONES:
+      return getNextActiveZone(currentZoneEnd) < ZONE_COUNT;
+    default:
+      return true;
+  }
 }
 
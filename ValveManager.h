@@ -5,18 +5,24 @@
 #include "Arduino.h"
 #include "DurationFsm.h"
 #include "WaterMeter.h"
+#include "StaticArena.h"
+#include "SerialLog.h"
+#include "RunStats.h"
+#include "Zones.h"
+#include "RunLog.h"
+#include "Telemetry.h"
 #include "Constants.h"
 
 #define UNUSED 255
 
 #define DURATION_WARN_SEC 2U
 #define DURATION_WAIT_BEFORE_SEC 60U
+// the fill ends as soon as no pulses were seen for DURATION_LEAK_CHECK_NO_PULSES_MS, at the latest after DURATION_LEAK_CHECK_FILL_MS
 #define DURATION_LEAK_CHECK_FILL_MS 3000U
+#define DURATION_LEAK_CHECK_NO_PULSES_MS 500U
 #define DURATION_LEAK_CHECK_WAIT_MS 2000U
-#define DEFAULT_DURATION_AUTOMATIC1_SEC 60U * 5U
-#define DEFAULT_DURATION_AUTOMATIC2_SEC 60U * 5U
-#define DEFAULT_DURATION_AUTOMATIC3_SEC 60U * 1U
-#define MAX_ZONE_DURATION 3600U
+// time a single zone runs before its flow is learned
+#define ZONE_FLOW_SETTLE_MS 20000U
 
 /**
    Definition of a valve with its PIN. Can be switched on/off and queried on its state.
@@ -59,9 +65,7 @@ class MeasuredValve: public Valve {
   public:
     MeasuredValve(byte pin, WaterMeter *waterMeter): Valve(pin), waterMeter(waterMeter) {
     }
-    virtual ~MeasuredValve() {
-      delete waterMeter;
-    }
+    virtual ~MeasuredValve() {}
     virtual void on() {
       waterMeter->start();
       Valve::on();
@@ -72,8 +76,8 @@ class MeasuredValve: public Valve {
       Valve::off();
       if (wasOn) {
         waterMeter->stop();
-        Serial.print(F("measured: "));
-        Serial.println(getTotalCount());
+        serialLog.print(F("measured: "));
+        serialLog.println(getTotalCount());
       }
     }
     unsigned long getTotalCount() {
@@ -84,172 +88,144 @@ class MeasuredValve: public Valve {
 };
 
 /**
-   A superState to switch a value on/off when it enters/exits
-*/
-class ValveSuperState: public SuperState {
-  public:
-    ValveSuperState(Valve * const valve, String name): SuperState(name), valve(valve) {
-    }
-    virtual void enter() {
-      valve->on();
-    }
-    virtual void exit() {
-      valve->off();
-    }
-  private:
-    Valve * const valve;
-};
-
-/**
-   A duration state to switch a valve on and later off again after a given delay.
-*/
-class ValveState: public DurationState {
-  public:
-    ValveState(Valve *valve, unsigned long durationMs, String name, SuperState * const superState): DurationState(durationMs, name, superState), valve(valve) {
-    }
-    virtual void enter() {
-      valve->on();
-    }
-    virtual void exit() {
-      valve->off();
-    }
-  private:
-    Valve * const valve;
-};
-
-/**
-   A state which checks if there are any water meter ticks while it is active.
-*/
-class LeakCheckState: public DurationState, public Runnable {
-  public:
-    LeakCheckState(unsigned long durationMs, String name, SuperState * const superState, Runnable * const listener, WaterMeter *waterMeter):
-      DurationState(durationMs, name, superState), waterMeter(waterMeter), listener(listener)  {
-    }
-    virtual void enter() {
-      startTotalCount = waterMeter->getTotalCount();
-      scheduler.scheduleDelayed(this, 100);
-    }
-    virtual void exit() {
-      scheduler.removeCallbacks(this);
-      checkLeak();
-    }
-    void run() {
-      scheduler.scheduleDelayed(this, 100);
-      checkLeak();
-    }
-  private:
-    WaterMeter * const waterMeter;
-    Runnable * const listener;
-    unsigned long startTotalCount;
-    void checkLeak() {
-      if (startTotalCount != waterMeter->getTotalCount()) {
-        scheduler.removeCallbacks(this);
-        scheduler.schedule(listener);
-        Serial.print(F("Leak count: "));
-        Serial.println(waterMeter->getTotalCount() - startTotalCount);
-      }
-    }
-};
-
-/**
-   A state which checks if there are any water meter ticks while it is active.
+   Receives how many water meter ticks were counted while the first zone was switched on for the warning.
 */
 class MeasureStateListener {
   public:
     virtual void measuredResult(unsigned int tickCount) = 0;
 };
-class MeasureState: public DurationState, public Runnable {
-  public:
-    MeasureState(Valve *valve, const unsigned long durationMs, const String name, SuperState * const superState, MeasureStateListener * const listener, WaterMeter *waterMeter):
-      DurationState(durationMs, name, superState), valve(valve), waterMeter(waterMeter), listener(listener) {
-    }
-    virtual void enter() {
-      startTotalCount = waterMeter->getTotalCount();
-      if (valve != NULL) {
-        valve->on();
-      }
-    }
-    virtual void exit() {
-      if (valve != NULL) {
-        valve->off();
-      }
-      tickCount = waterMeter->getTotalCount() - startTotalCount;
-      // need to use scheduler to allow manipulation of the state machine
-      scheduler.schedule(this);
-    }
-    void run() {
-      listener->measuredResult(tickCount);
-    }
-  private:
-    Valve * const valve;
-    WaterMeter * const waterMeter;
-    MeasureStateListener * const listener;
-    unsigned long startTotalCount;
-    unsigned int tickCount;
-};
-
 
-class ValveManager {
+class ValveManager: private DurationTransitionListener {
   public:
     /**
        @param waterMeter the WaterMeter to use for the measured valve. Cannot be null.
        @param sensorCheckListener callback to report how many ticks the sensor has reported during a period when water should be flowing
        @param leakCheckListener callback executed when a leak is detected (if activated)
+       @param flowDeviationListener callback executed when the flow of the watered zones left their learned range
     */
     ValveManager(WaterMeter *waterMeter,
                  MeasureStateListener * const waterMeterCheckListener,
-                 Runnable * const leakCheckListener);
-    ~ValveManager();
+                 Runnable * const leakCheckListener,
+                 Runnable * const flowDeviationListener);
+    virtual ~ValveManager() {}
     /**
        start automated watering with a warn second before the actual watering.
+       @param zones the zones to water
     */
-    void startAutomaticWithWarn();
+    void startAutomaticWithWarn(ZoneMask zones = ALL_ZONES);
     /**
        start automated watering without a warn second.
     */
     void startAutomatic();
     /**
        Stop watering, switch all valves off.
+       @param endReason stored in the run log if watering was running, one of RUN_END_*
     */
-    void stopAll();
+    void stopAll(byte endReason = RUN_END_MANUAL);
     /**
        returns true if any watering is currently running. Can also be in a waiting state. False if currently idle.
     */
     bool isOn();
+    /**
+       Set the flow that zones watered at the same time may use together.
+       @param pulsesPerMinute sum of the learned zone flows allowed in parallel, 0 to water one zone at a time
+    */
+    inline void setFlowBudget(unsigned int pulsesPerMinute) {
+      flowBudget = pulsesPerMinute;
+    }
     /**
       Set and store the duration the given zone will be on persistently.
-      @param zone number of the zone to be set, 1, 2 or 3
+      @param zone number of the zone to be set, 1 to ZONE_COUNT
       @param durationSec duration in seconds how long the zone will be watered on every automatic run
     */
     void setZoneDuration(byte zone, unsigned int durationSec);
+    /**
+      Set and store the volume after which the given zone is stopped persistently.
+      The zone duration stays the limit in case the volume is not reached.
+      @param zone number of the zone to be set, 1 to ZONE_COUNT
+      @param volumeLitres litres to water the zone on every automatic run, 0 to water for the duration only
+    */
+    void setZoneVolume(byte zone, unsigned int volumeLitres);
     /**
       print the status of ValveManager to serial.
     */
     void printStatus();
+    /**
+      fills the valve state, zone and watering flag into the frame.
+    */
+    void getTelemetry(TelemetryFrame &frame);
   private:
     MeasuredValve *valveMain;
-    Valve *valveArea1;
-    Valve *valveArea2;
-    Valve *valveArea3;
+    // the states before and while watering refer to the zones from currentZone to before currentZoneEnd
+    byte currentZone;
+    byte currentZoneEnd;
+    // zones of the current automatic run
+    ZoneMask activeZones;
+    byte runEndReason;
+    // zones of the zone state to add to the run log when it is left
+    byte loggedZone;
+    byte loggedZoneEnd;
+    unsigned long loggedZoneStartTotalCount;
+    unsigned int flowBudget;
+    // expected flow of the open zones in pulses per minute, flowBandMax is 0 if it is not known
+    unsigned int flowBandMin;
+    unsigned int flowBandMax;
+    WaterMeter * const waterMeter;
+    MeasureStateListener * const waterMeterCheckListener;
+    Runnable * const leakCheckListener;
+    Runnable * const flowDeviationListener;
+
+    unsigned long leakCheckStartTotalCount;
 
-    DurationFsm *fsm;
-    SuperState *superStateMainIdle;
-    ValveSuperState *superStateMainOn;
+    /**
+      Reports the measured ticks through the scheduler to allow manipulation of the state machine.
+    */
+    class MeasuredResult: public Runnable {
+      public:
+        MeasuredResult(ValveManager &valveManager): valveManager(valveManager) {}
+        void run() {
+          MEASURE_RUN(RUN_STATS_VALVE_MANAGER);
+          valveManager.waterMeterCheckListener->measuredResult(valveManager.measuredTickCount);
+        }
+      private:
+        ValveManager &valveManager;
+    };
+    MeasuredResult measuredResult;
+    unsigned long measureStartTotalCount;
+    unsigned int measuredTickCount;
 
-    DurationState *stateIdle;
-    DurationState *stateLeakCheckFill;
-    DurationState *stateLeakCheckWait;
-    DurationState *stateWarnAutomatic1;
-    DurationState *stateWaitBeforeAutomatic1;
-    DurationState *stateAutomatic1;
-    DurationState *stateBeforeWarnAutomatic2;
-    DurationState *stateWarnAutomatic2;
-    DurationState *stateWaitBeforeAutomatic2;
-    DurationState *stateAutomatic2;
-    DurationState *stateBeforeWarnAutomatic3;
-    DurationState *stateWarnAutomatic3;
-    DurationState *stateWaitBeforeAutomatic3;
-    DurationState *stateAutomatic3;
+    /**
+      Learns the flow of a single zone or switches off the zones of a group that finished before the others.
+    */
+    class ZoneTimer: public Runnable {
+      public:
+        ZoneTimer(ValveManager &valveManager): valveManager(valveManager) {}
+        void run() {
+          MEASURE_RUN(RUN_STATS_VALVE_MANAGER);
+          valveManager.updateZones();
+        }
+      private:
+        ValveManager &valveManager;
+    };
+    ZoneTimer zoneTimer;
+    void updateZones();
+    void updateFlowBand();
+
+    TableDurationFsm fsm;
+
+    byte getNextActiveZone(byte zone);
+    byte getZoneGroupEnd(byte firstZone);
+    void allZonesOff();
+    void logZones();
+    // methods from DurationTransitionListener
+    void exitState(byte state);
+    void enterState(byte state);
+    unsigned long getMinDurationMs(byte state, unsigned long tableDurationMs);
+    byte getNextState(byte state, byte tableNextState);
+    bool checkGuard(byte guard);
+  public:
+    // memory ValveManager allocates from the arena
+    static const size_t ARENA_BYTES = ARENA_SIZEOF(MeasuredValve);
 };
 
 #endif
@@ -1,53 +1,59 @@
 
 #include "WaterManager.h"
 #include "LedState.h"
-#include <EEPROMWearLevel.h> // https://github.com/PRosenb/EEPROMWearLevel
+#include "ConfigStore.h"
 
 WaterManager::WaterManager() {
-  unsigned int waterMeterStopThreshold = DEFAULT_WATER_METER_STOP_THRESHOLD;
-  waterMeterStopThreshold = EEPROMwl.get(EEPROM_INDEX_WATER_METER_THRESHOLD, waterMeterStopThreshold);
   stoppedByThreshold = 0;
 
-  waterMeter = new WaterMeter(1000);
-  waterMeter->setThresholdSupervisionDelay(PIPE_FILLING_TIME_MS);
-  waterMeter->setThresholdListener(waterMeterStopThreshold, this);
+  waterMeter = new (arena) WaterMeter(WATER_METER_WINDOW_MS);
+  waterMeter->setThresholdSupervisionDelay(PIPE_FILLING_MAX_TIME_MS);
+  waterMeter->setThresholdListener(config.getWaterMeterStopThreshold(), this);
 
-  valveManager = new ValveManager(waterMeter, waterMeterCheckListener, leakCheckListener);
+  valveManager = new (arena) ValveManager(waterMeter, waterMeterCheckListener, leakCheckListener, flowDeviationListener);
+  setFlowBudget(config.getWaterMeterStopThreshold());
+  waterMeter->setIdleLeakListener(config.getIdleLeakLitres() * WATER_METER_PULSES_PER_LITRE, IDLE_LEAK_WINDOW_MS, idleLeakListener);
 
   initModeFsm();
 }
 
-WaterManager::~WaterManager() {
-  delete valveManager;
-  delete waterMeter;
-
-  delete modeOff;
-  delete modeOffOnce;
-  delete modeAutomatic;
-  delete modeFsm;
-}
-
 void WaterManager::run() {
+  MEASURE_RUN(RUN_STATS_WATER_MANAGER);
   stoppedByThreshold = waterMeter->getLastPulseCountOverThreshold();
-  Serial.print(F("ThresholdListener: "));
-  Serial.println(stoppedByThreshold);
-  valveManager->stopAll();
+  serialLog.print(F("ThresholdListener: "));
+  serialLog.println(stoppedByThreshold);
+  valveManager->stopAll(RUN_END_THRESHOLD);
   modeFsm->changeState(*modeOff);
 }
 
 void WaterManager::leakCheckListenerCallback() {
-  Serial.println(F("Leak detected"));
-  valveManager->stopAll();
+  serialLog.println(F("Leak detected"));
+  valveManager->stopAll(RUN_END_LEAK);
+  modeFsm->changeState(*modeOff);
+}
+
+void WaterManager::flowDeviationListenerCallback() {
+  // a burst pipe or a clogged zone, both need to be checked before watering again
+  serialLog.print(F("Flow deviation: "));
+  serialLog.println(waterMeter->getLastPulseCountOutOfBand());
+  valveManager->stopAll(RUN_END_FLOW_DEVIATION);
+  modeFsm->changeState(*modeOff);
+}
+
+void WaterManager::idleLeakListenerCallback() {
+  // idle monitoring only runs without a run but a run may have started since the listener was scheduled
+  serialLog.println(F("Idle leak detected"));
+  valveManager->stopAll(RUN_END_LEAK);
   modeFsm->changeState(*modeOff);
 }
 
 void WaterManager::waterMeterCheckCallback(unsigned int tickCount) {
-  Serial.print(F("sensorCheckCallback: "));
-  Serial.println(tickCount);
+  serialLog.print(F("sensorCheckCallback: "));
+  serialLog.println(tickCount);
 #ifdef CHECK_WATER_METER_AVAILABLE
   if (tickCount == 0) {
-    Serial.println(F("Water meter not connected"));
-    valveManager->stopAll();
+    serialLog.println(F("Water meter not connected"));
+    valveManager->stopAll(RUN_END_NO_WATER_METER);
     modeFsm->changeState(*modeOff);
   }
 #endif
@@ -58,27 +64,45 @@ void WaterManager::initModeFsm() {
   pinMode(COLOR_LED_RED_PIN, OUTPUT);
   pinMode(COLOR_LED_BLUE_PIN, OUTPUT);
 
-  modeOff = new ColorLedState(0, 255, 0, INFINITE_DURATION, 10000, F("modeOff"));
-  modeOffOnce = new ColorLedState(0, 255, 255, INFINITE_DURATION, 10000, F("modeOffOnce"));
-  modeAutomatic = new ColorLedState(255, 0, 0, INFINITE_DURATION, 10000, F("modeAutomatic"));
+  modeOff = new (arena) ColorLedState(0, 255, 0, INFINITE_DURATION, 10000, F("modeOff"));
+  modeOffOnce = new (arena) ColorLedState(0, 255, 255, INFINITE_DURATION, 10000, F("modeOffOnce"));
+  modeAutomatic = new (arena) ColorLedState(255, 0, 0, INFINITE_DURATION, 10000, F("modeAutomatic"));
   // for simple LED test:
-  //  modeOff = new ColorLedState(255, MODE_COLOR_RED_PIN, MODE_COLOR_BLUE_PIN, 10000, F("modeOff"));
-  //  modeOffOnce = new ColorLedState(MODE_COLOR_GREEN_PIN, 255, MODE_COLOR_BLUE_PIN, 10000, F("modeOffOnce"));
-  //  modeAutomatic = new ColorLedState(MODE_COLOR_GREEN_PIN, MODE_COLOR_RED_PIN, 255, 10000, F("modeAutomatic"));
+  //  modeOff = new (arena) ColorLedState(255, MODE_COLOR_RED_PIN, MODE_COLOR_BLUE_PIN, 10000, F("modeOff"));
+  //  modeOffOnce = new (arena) ColorLedState(MODE_COLOR_GREEN_PIN, 255, MODE_COLOR_BLUE_PIN, 10000, F("modeOffOnce"));
+  //  modeAutomatic = new (arena) ColorLedState(MODE_COLOR_GREEN_PIN, MODE_COLOR_RED_PIN, 255, 10000, F("modeAutomatic"));
   modeOff->nextState = modeAutomatic;
   modeAutomatic->nextState = modeOffOnce;
   modeOffOnce->nextState = modeOff;
 
-  modeFsm = new DurationFsm(*modeOff, F("ModeFSM"));
+  modeFsm = new (arena) DurationFsm(*modeOff, F("ModeFSM"));
 }
 
 void WaterManager::setZoneDuration(byte zone, unsigned int durationSec) {
   valveManager->setZoneDuration(zone, durationSec);
 }
 
+void WaterManager::setZoneVolume(byte zone, unsigned int volumeLitres) {
+  valveManager->setZoneVolume(zone, volumeLitres);
+}
+
 void WaterManager::setWaterMeterStopThreshold(int ticksPerSecond) {
-  EEPROMwl.put(EEPROM_INDEX_WATER_METER_THRESHOLD, ticksPerSecond);
+  config.setWaterMeterStopThreshold(ticksPerSecond);
   waterMeter->setThresholdListener(ticksPerSecond, this);
+  setFlowBudget(ticksPerSecond);
+}
+
+void WaterManager::setIdleLeakVolume(unsigned int volumeLitres) {
+  if (volumeLitres > MAX_IDLE_LEAK_LITRES) {
+    volumeLitres = MAX_IDLE_LEAK_LITRES;
+  }
+  config.setIdleLeakLitres(volumeLitres);
+  waterMeter->setIdleLeakListener(volumeLitres * WATER_METER_PULSES_PER_LITRE, IDLE_LEAK_WINDOW_MS, idleLeakListener);
+}
+
+void WaterManager::setFlowBudget(unsigned int ticksPerWindow) {
+  // the zone flows are in pulses per minute
+  valveManager->setFlowBudget(ticksPerWindow * (60000UL / WATER_METER_WINDOW_MS) * PARALLEL_FLOW_BUDGET_PERCENT / 100);
 }
 
 void WaterManager::printStatus() {
@@ -87,14 +111,41 @@ void WaterManager::printStatus() {
   Serial.print(waterMeter->getTotalCount());
   Serial.print(F(", stop threshold: "));
   Serial.print(waterMeter->getSamplesInInterval());
+  Serial.print(F(", flow: "));
+  Serial.print(waterMeter->getInstantaneousFlow());
+  Serial.print(F("/min, avg: "));
+  Serial.print(waterMeter->getAveragedFlow());
+  Serial.print(F("/min"));
   if (stoppedByThreshold > 0) {
     Serial.print(F(", stopped by threshold: "));
     Serial.print(stoppedByThreshold);
   }
+  Serial.print(F(", idle: "));
+  Serial.print(waterMeter->getIdleTotalCount());
   Serial.println();
   valveManager->printStatus();
 }
 
+void WaterManager::getTelemetry(TelemetryFrame &frame) {
+  frame.totalPulses = waterMeter->getTotalCount();
+  frame.flow = waterMeter->getInstantaneousFlow();
+  frame.stoppedByThreshold = stoppedByThreshold;
+  if (modeFsm->isInState(*modeAutomatic)) {
+    frame.mode = TELEMETRY_MODE_AUTOMATIC;
+  } else if (modeFsm->isInState(*modeOffOnce)) {
+    frame.mode = TELEMETRY_MODE_OFF_ONCE;
+  } else {
+    frame.mode = TELEMETRY_MODE_OFF;
+  }
+  if (waterMeter->isThresholdSupervised()) {
+    frame.flags |= TELEMETRY_FLAG_THRESHOLD_SUPERVISED;
+  }
+  if (stoppedByThreshold > 0) {
+    frame.flags |= TELEMETRY_FLAG_STOPPED_BY_THRESHOLD;
+  }
+  valveManager->getTelemetry(frame);
+}
+
 void WaterManager::modeClicked() {
   if (valveManager->isOn()) {
     valveManager->stopAll();
@@ -108,13 +159,13 @@ void WaterManager::modeClicked() {
   ((ColorLedState&)modeFsm->getCurrentState()).reactivateLed();
 }
 
-void WaterManager::startAutomaticRtc() {
+void WaterManager::startAutomaticRtc(ZoneMask zones) {
   if (modeFsm->isInState(*modeAutomatic)) {
-    valveManager->startAutomaticWithWarn();
+    valveManager->startAutomaticWithWarn(zones);
   } else if (modeFsm->isInState(*modeOffOnce)) {
     modeFsm->changeState(*modeAutomatic);
   } else {
-    Serial.println(F("startAutomaticRtc() ignored due to current mode"));
+    serialLog.println(F("startAutomaticRtc() ignored due to current mode"));
   }
   ((ColorLedState&)modeFsm->getCurrentState()).reactivateLed();
 }
@@ -127,3 +178,11 @@ unsigned long WaterManager::getUsedWater() {
   return waterMeter->getTotalCount();
 }
 
+unsigned long WaterManager::getIdlePulses() {
+  return waterMeter->getIdleTotalCount();
+}
+
+bool WaterManager::isWatering() {
+  return valveManager->isOn();
+}
+
@@ -7,16 +7,25 @@
 #include "WaterMeter.h"
 #include "ValveManager.h"
 #include "LedState.h"
+#include "StaticArena.h"
+#include "RunStats.h"
+#include "Telemetry.h"
 #include "Constants.h"
 
-#define PIPE_FILLING_TIME_MS 11000
-// free flow around 68 per second
-#define DEFAULT_WATER_METER_STOP_THRESHOLD 68U
+// the threshold is supervised once the flow settled after filling the pipe, at the latest after this time
+#define PIPE_FILLING_MAX_TIME_MS 11000
+#define WATER_METER_WINDOW_MS 1000
+// part of the stop threshold zones watered in parallel may use together
+#define PARALLEL_FLOW_BUDGET_PERCENT 80
+// water flowing while all valves are closed is summed up over this time to detect small leaks
+#define IDLE_LEAK_WINDOW_MS (60UL * 60UL * 1000UL)
+// the idle leak volume in pulses needs to fit into an unsigned int
+#define MAX_IDLE_LEAK_LITRES (0xFFFFU / WATER_METER_PULSES_PER_LITRE)
 
 class WaterManager: public Runnable {
   public:
     WaterManager();
-    ~WaterManager();
+    ~WaterManager() {}
     /**
        Switch to next mode. Called when the mode button is pressed.
     */
@@ -24,8 +33,9 @@ class WaterManager: public Runnable {
     /**
        Start automatic watering with first one second on as warning.
        If mode is set to modeOffOnce, it is switched back to modeAutomatic.
+       @param zones the zones to water
     */
-    void startAutomaticRtc();
+    void startAutomaticRtc(ZoneMask zones = ALL_ZONES);
     /**
        Start automatic watering without warning second.
        This is done on button press.
@@ -33,25 +43,49 @@ class WaterManager: public Runnable {
     void startAutomatic();
     /**
        Set and store the duration the given zone will be on persistently.
-       @param zone number of the zone to be set, 1, 2 or 3
+       @param zone number of the zone to be set, 1 to ZONE_COUNT
        @param durationSec duration in seconds how long the zone will be watered on every automatic run
     */
     void setZoneDuration(byte zone, unsigned int durationSec);
+    /**
+       Set and store the volume after which the given zone is stopped persistently.
+       @param zone number of the zone to be set, 1 to ZONE_COUNT
+       @param volumeLitres litres to water the zone on every automatic run, 0 to water for the duration only
+    */
+    void setZoneVolume(byte zone, unsigned int volumeLitres);
     /**
        Set the amount of water meter ticks to stop watering if it is reached or exeeded.
     */
     void setWaterMeterStopThreshold(int ticksPerSecond);
+    /**
+       Set and store the volume that flows within IDLE_LEAK_WINDOW_MS while no valve is open to report a leak.
+       @param volumeLitres litres up to MAX_IDLE_LEAK_LITRES, 0 to stop the monitoring
+    */
+    void setIdleLeakVolume(unsigned int volumeLitres);
     /**
        return the total ticks count of the water meter since system started.
     */
     unsigned long getUsedWater();
+    /**
+       return the ticks count of the water meter while no valve was open since system started.
+    */
+    unsigned long getIdlePulses();
+    /**
+       returns true if any watering is currently running, including the waiting states.
+    */
+    bool isWatering();
     void printStatus();
+    /**
+       fills the values of the current state into the frame.
+    */
+    void getTelemetry(TelemetryFrame &frame);
     /**
        Do not call from external, used internally only.
     */
     void run();
   private:
     void initModeFsm();
+    void setFlowBudget(unsigned int ticksPerWindow);
     ValveManager *valveManager;
     WaterMeter *waterMeter;
     unsigned int stoppedByThreshold;
@@ -63,11 +97,12 @@ class WaterManager: public Runnable {
     DurationFsm *modeFsm;
 
     // leak check callback
-    Runnable * const leakCheckListener = new LeakCheckListener(*this);
+    Runnable * const leakCheckListener = new (arena) LeakCheckListener(*this);
     class LeakCheckListener: public Runnable {
       public:
         LeakCheckListener(WaterManager &waterManager): waterManager(waterManager) {}
         void run() {
+          MEASURE_RUN(RUN_STATS_WATER_MANAGER);
           waterManager.leakCheckListenerCallback();
         }
       private:
@@ -75,8 +110,36 @@ class WaterManager: public Runnable {
     };
     void leakCheckListenerCallback();
 
+    // idle leak callback
+    Runnable * const idleLeakListener = new (arena) IdleLeakListener(*this);
+    class IdleLeakListener: public Runnable {
+      public:
+        IdleLeakListener(WaterManager &waterManager): waterManager(waterManager) {}
+        void run() {
+          MEASURE_RUN(RUN_STATS_WATER_MANAGER);
+          waterManager.idleLeakListenerCallback();
+        }
+      private:
+        WaterManager &waterManager;
+    };
+    void idleLeakListenerCallback();
+
+    // flow deviation callback
+    Runnable * const flowDeviationListener = new (arena) FlowDeviationListener(*this);
+    class FlowDeviationListener: public Runnable {
+      public:
+        FlowDeviationListener(WaterManager &waterManager): waterManager(waterManager) {}
+        void run() {
+          MEASURE_RUN(RUN_STATS_WATER_MANAGER);
+          waterManager.flowDeviationListenerCallback();
+        }
+      private:
+        WaterManager &waterManager;
+    };
+    void flowDeviationListenerCallback();
+
     // sensor check callback
-    MeasureStateListener * const waterMeterCheckListener = new WaterMeterCheckListener(*this);
+    MeasureStateListener * const waterMeterCheckListener = new (arena) WaterMeterCheckListener(*this);
     class WaterMeterCheckListener: public MeasureStateListener {
       public:
         WaterMeterCheckListener(WaterManager &waterManager): waterManager(waterManager) {}
@@ -87,6 +150,12 @@ class WaterManager: public Runnable {
         WaterManager &waterManager;
     };
     void waterMeterCheckCallback(unsigned int tickCount);
+  public:
+    // memory WaterManager allocates from the arena, including the one of ValveManager
+    static const size_t ARENA_BYTES = ARENA_SIZEOF(WaterMeter) + ARENA_SIZEOF(ValveManager) + ValveManager::ARENA_BYTES
+                                      + 3 * ARENA_SIZEOF(ColorLedState) + ARENA_SIZEOF(DurationFsm)
+                                      + ARENA_SIZEOF(LeakCheckListener) + ARENA_SIZEOF(IdleLeakListener)
+                                      + ARENA_SIZEOF(FlowDeviationListener) + ARENA_SIZEOF(WaterMeterCheckListener);
 };
 
 #endif
@@ -6,19 +6,52 @@
 #include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
 
 #include "WaterMeter.h"
+#include "RunStats.h"
 
 volatile unsigned int WaterMeter::samplesInInterval;
 volatile unsigned long WaterMeter::totalPulseCount;
-volatile unsigned long WaterMeter::lastPulseCount;
+volatile byte WaterMeter::windowBuckets[WINDOW_BUCKET_COUNT];
+volatile byte WaterMeter::windowBucketIndex;
+volatile unsigned int WaterMeter::windowPulseCount;
+volatile bool WaterMeter::thresholdSupervised;
+volatile bool WaterMeter::thresholdReported;
 volatile unsigned int WaterMeter::lastPulseCountOverThreshold;
+volatile Runnable *WaterMeter::flowBandListener;
+volatile unsigned int WaterMeter::flowBandMinPulses;
+volatile unsigned int WaterMeter::flowBandMaxPulses;
+volatile byte WaterMeter::flowBandLowSteps;
+volatile bool WaterMeter::flowBandReported;
+volatile unsigned int WaterMeter::lastPulseCountOutOfBand;
+volatile unsigned int WaterMeter::pipeFillPreviousCount;
+volatile byte WaterMeter::pipeFillSettledWindows;
 volatile Runnable *WaterMeter::listener;
+TableDurationFsm * volatile WaterMeter::pulseCountFsm;
+volatile byte WaterMeter::pulseCountEvent;
+volatile unsigned long WaterMeter::pulseCountEventCount;
+TableDurationFsm * volatile WaterMeter::noPulsesFsm;
+volatile byte WaterMeter::noPulsesEvent;
+volatile unsigned int WaterMeter::noPulsesSteps;
+volatile unsigned int WaterMeter::stepsSincePulse;
+volatile unsigned long WaterMeter::pulseTimesUs[PULSE_TIMES_COUNT];
+volatile byte WaterMeter::pulseTimesNext;
+volatile byte WaterMeter::pulseTimesCount;
+volatile Runnable *WaterMeter::idleLeakListener;
+volatile unsigned int WaterMeter::idleLeakPulses;
+volatile unsigned int WaterMeter::idleBuckets[IDLE_LEAK_BUCKET_COUNT];
+volatile byte WaterMeter::idleBucketIndex;
+volatile unsigned int WaterMeter::idleWindowPulseCount;
+volatile bool WaterMeter::idleLeakReported;
+volatile unsigned long WaterMeter::idleTotalCount;
 
-WaterMeter::WaterMeter(const unsigned long invervalMs) {
+WaterMeter::WaterMeter(const unsigned long windowMs): windowStepMs(windowMs / WINDOW_BUCKET_COUNT), idleWindow(*this) {
   pinMode(WATER_METER_PIN, INPUT_PULLUP);
-  MsTimer2::set(invervalMs, WaterMeter::isrTimer);
+  MsTimer2::set(windowStepMs, WaterMeter::isrTimer);
+  thresholdSupervised = false;
   totalPulseCount = 0;
   lastPulseCountOverThreshold = 0;
   started = false;
+  // the system starts without a run
+  idleMonitoring = true;
 }
 
 WaterMeter::~WaterMeter() {
@@ -28,49 +61,308 @@ void WaterMeter::start() {
   if (!started) {
     started = true;
     scheduler.acquireNoSleepLock();
+    scheduler.removeCallbacks(&idleWindow);
 
-    enableInterrupt(WATER_METER_PIN, WaterMeter::isrWaterMeterPulses, FALLING);
-    if (thresholdSupervisionDelay == 0) {
-      lastPulseCount = totalPulseCount;
-      MsTimer2::start();
-    } else {
-      scheduler.scheduleDelayed(this, thresholdSupervisionDelay);
+    // timestamps of the last run do not tell anything about the current flow
+    pulseTimesCount = 0;
+    noInterrupts();
+    for (byte i = 0; i < WINDOW_BUCKET_COUNT; i++) {
+      windowBuckets[i] = 0;
     }
+    windowPulseCount = 0;
+    interrupts();
+    // replaces the idle interrupt if it is enabled
+    enableInterrupt(WATER_METER_PIN, WaterMeter::isrWaterMeterPulses, FALLING);
+    MsTimer2::start();
+    startPipeFillDetection();
+  }
+}
+
+void WaterMeter::restartThresholdSupervision() {
+  if (started) {
+    scheduler.removeCallbacks(this);
+    startPipeFillDetection();
+  }
+}
+
+void WaterMeter::startPipeFillDetection() {
+  if (thresholdSupervisionDelay == 0) {
+    startThresholdSupervision();
+  } else {
+    noInterrupts();
+    thresholdSupervised = false;
+    pipeFillPreviousCount = 0;
+    pipeFillSettledWindows = 0;
+    interrupts();
+    // in case the pulse rate does not settle
+    scheduler.scheduleDelayed(this, thresholdSupervisionDelay);
   }
 }
 
 void WaterMeter::stop() {
   if (started) {
     started = false;
+    thresholdSupervised = false;
     MsTimer2::stop();
     disableInterrupt(WATER_METER_PIN);
     scheduler.releaseNoSleepLock();
     scheduler.removeCallbacks(this);
+    if (idleMonitoring && idleLeakPulses > 0) {
+      // the window continues where it was
+      enableInterrupt(WATER_METER_PIN, WaterMeter::isrIdlePulses, FALLING);
+      scheduler.scheduleDelayed(&idleWindow, idleWindowStepMs);
+    }
+  }
+}
+
+void WaterMeter::setIdleLeakListener(const unsigned int pulses, const unsigned long windowMs, Runnable *listener) {
+  noInterrupts();
+  idleLeakPulses = pulses;
+  idleLeakListener = listener;
+  interrupts();
+  idleWindowStepMs = windowMs / IDLE_LEAK_BUCKET_COUNT;
+  if (idleMonitoring) {
+    startIdleMonitoring();
+  }
+}
+
+void WaterMeter::startIdleMonitoring() {
+  idleMonitoring = true;
+  if (idleLeakPulses == 0) {
+    disarmIdleMonitoring();
+    return;
+  }
+  noInterrupts();
+  for (byte i = 0; i < IDLE_LEAK_BUCKET_COUNT; i++) {
+    idleBuckets[i] = 0;
   }
+  idleWindowPulseCount = 0;
+  idleLeakReported = false;
+  interrupts();
+  if (!started) {
+    // no timer and no sleep lock, the pin change interrupt also wakes the system from deep sleep
+    enableInterrupt(WATER_METER_PIN, WaterMeter::isrIdlePulses, FALLING);
+  }
+  scheduler.removeCallbacks(&idleWindow);
+  scheduler.scheduleDelayed(&idleWindow, idleWindowStepMs);
+}
+
+void WaterMeter::stopIdleMonitoring() {
+  idleMonitoring = false;
+  disarmIdleMonitoring();
+}
+
+void WaterMeter::disarmIdleMonitoring() {
+  scheduler.removeCallbacks(&idleWindow);
+  if (!started) {
+    disableInterrupt(WATER_METER_PIN);
+  }
+}
+
+void WaterMeter::slideIdleWindow() {
+  noInterrupts();
+  idleBucketIndex = (idleBucketIndex + 1) % IDLE_LEAK_BUCKET_COUNT;
+  idleWindowPulseCount -= idleBuckets[idleBucketIndex];
+  idleBuckets[idleBucketIndex] = 0;
+  if (idleWindowPulseCount < idleLeakPulses) {
+    idleLeakReported = false;
+  }
+  interrupts();
+  scheduler.scheduleDelayed(&idleWindow, idleWindowStepMs);
 }
 
 void WaterMeter::run() {
-  if (started) {
-    lastPulseCount = totalPulseCount;
-    MsTimer2::start();
+  MEASURE_RUN(RUN_STATS_WATER_METER);
+  if (started && !thresholdSupervised) {
+    startThresholdSupervision();
   }
 }
 
+void WaterMeter::startThresholdSupervision() {
+  noInterrupts();
+  thresholdReported = false;
+  flowBandReported = false;
+  flowBandLowSteps = 0;
+  thresholdSupervised = true;
+  interrupts();
+}
+
 void WaterMeter::setThresholdListener(const unsigned int samplesInInterval, Runnable *listener) {
   WaterMeter::samplesInInterval = samplesInInterval;
   WaterMeter::listener = listener;
 }
 
+void WaterMeter::setFlowBand(const unsigned int minFlow, const unsigned int maxFlow, Runnable *listener) {
+  const unsigned long windowMs = windowStepMs * WINDOW_BUCKET_COUNT;
+  // one pulse more or less only depends on where the window starts
+  const unsigned int minPulses = minFlow * windowMs / 60000UL;
+  const unsigned int maxPulses = (maxFlow * windowMs + 59999UL) / 60000UL + 1;
+  noInterrupts();
+  flowBandMinPulses = minPulses > 0 ? minPulses - 1 : 0;
+  flowBandMaxPulses = maxPulses;
+  flowBandLowSteps = 0;
+  flowBandReported = false;
+  flowBandListener = listener;
+  interrupts();
+}
+
+void WaterMeter::removeFlowBand() {
+  flowBandListener = NULL;
+}
+
+unsigned int WaterMeter::getInstantaneousFlow() {
+  return getFlow(1);
+}
+
+unsigned int WaterMeter::getAveragedFlow() {
+  return getFlow(PULSE_TIMES_COUNT - 1);
+}
+
+unsigned int WaterMeter::getFlow(byte intervals) {
+  noInterrupts();
+  const byte count = pulseTimesCount;
+  if (count < 2) {
+    interrupts();
+    return 0;
+  }
+  const byte newestIndex = (pulseTimesNext + PULSE_TIMES_COUNT - 1) % PULSE_TIMES_COUNT;
+  if (intervals > count - 1) {
+    intervals = count - 1;
+  }
+  const unsigned long newestUs = pulseTimesUs[newestIndex];
+  const unsigned long oldestUs = pulseTimesUs[(newestIndex + PULSE_TIMES_COUNT - intervals) % PULSE_TIMES_COUNT];
+  const unsigned long lastIntervalUs = newestUs - pulseTimesUs[(newestIndex + PULSE_TIMES_COUNT - 1) % PULSE_TIMES_COUNT];
+  interrupts();
+
+  unsigned long intervalUs = newestUs - oldestUs;
+  // no pulse for longer than the last interval means that the flow went down
+  const unsigned long sinceNewestUs = micros() - newestUs;
+  if (sinceNewestUs > lastIntervalUs) {
+    intervalUs += sinceNewestUs - lastIntervalUs;
+  }
+  if (intervalUs == 0) {
+    return 0;
+  }
+  return intervals * 60000000UL / intervalUs;
+}
+
+void WaterMeter::setPulseCountEvent(const unsigned long pulseCount, TableDurationFsm *fsm, const byte event) {
+  noInterrupts();
+  if (totalPulseCount >= pulseCount) {
+    pulseCountFsm = NULL;
+    interrupts();
+    fsm->postEvent(event);
+  } else {
+    pulseCountEventCount = pulseCount;
+    pulseCountEvent = event;
+    pulseCountFsm = fsm;
+    interrupts();
+  }
+}
+
+void WaterMeter::removePulseCountEvent() {
+  pulseCountFsm = NULL;
+}
+
+void WaterMeter::setNoPulsesEvent(const unsigned long noPulsesMs, TableDurationFsm *fsm, const byte event) {
+  noInterrupts();
+  noPulsesSteps = (noPulsesMs + windowStepMs - 1) / windowStepMs;
+  stepsSincePulse = 0;
+  noPulsesEvent = event;
+  noPulsesFsm = fsm;
+  interrupts();
+}
+
+void WaterMeter::removeNoPulsesEvent() {
+  noPulsesFsm = NULL;
+}
+
 void WaterMeter::isrWaterMeterPulses() {
   totalPulseCount++;
+  stepsSincePulse = 0;
+  if (pulseCountFsm != NULL && totalPulseCount >= pulseCountEventCount) {
+    pulseCountFsm->postEvent(pulseCountEvent);
+    pulseCountFsm = NULL;
+  }
+  pulseTimesUs[pulseTimesNext] = micros();
+  pulseTimesNext = (pulseTimesNext + 1) % PULSE_TIMES_COUNT;
+  if (pulseTimesCount < PULSE_TIMES_COUNT) {
+    pulseTimesCount++;
+  }
+
+  if (windowBuckets[windowBucketIndex] < 255) {
+    windowBuckets[windowBucketIndex]++;
+    windowPulseCount++;
+    // check on every pulse so that the listener is called as soon as the window is over the threshold
+    if (thresholdSupervised && listener != NULL && !thresholdReported && windowPulseCount >= samplesInInterval) {
+      thresholdReported = true;
+      lastPulseCountOverThreshold = windowPulseCount;
+      scheduler.schedule((Runnable*) listener);
+    }
+    if (thresholdSupervised && flowBandListener != NULL && !flowBandReported && windowPulseCount > flowBandMaxPulses) {
+      flowBandReported = true;
+      lastPulseCountOutOfBand = windowPulseCount;
+      scheduler.schedule((Runnable*) flowBandListener);
+    }
+  }
+}
+
+void WaterMeter::IdleWindow::run() {
+  MEASURE_RUN(RUN_STATS_WATER_METER);
+  waterMeter.slideIdleWindow();
+}
+
+void WaterMeter::isrIdlePulses() {
+  idleTotalCount++;
+  if (idleBuckets[idleBucketIndex] < 0xFFFF) {
+    idleBuckets[idleBucketIndex]++;
+    idleWindowPulseCount++;
+  }
+  if (idleLeakListener != NULL && !idleLeakReported && idleWindowPulseCount >= idleLeakPulses) {
+    idleLeakReported = true;
+    scheduler.schedule((Runnable*) idleLeakListener);
+  }
 }
 
 void WaterMeter::isrTimer() {
-  unsigned int pulsesCount = totalPulseCount - lastPulseCount;
-  lastPulseCount = totalPulseCount;
-  if (listener != NULL && pulsesCount >= samplesInInterval) {
-    lastPulseCountOverThreshold = pulsesCount;
-    scheduler.schedule((Runnable*) listener);
+  // the window is complete before it slides
+  if (thresholdSupervised && flowBandListener != NULL && !flowBandReported) {
+    if (windowPulseCount >= flowBandMinPulses) {
+      flowBandLowSteps = 0;
+    } else if (++flowBandLowSteps >= FLOW_BAND_LOW_STEPS) {
+      flowBandReported = true;
+      lastPulseCountOutOfBand = windowPulseCount;
+      scheduler.schedule((Runnable*) flowBandListener);
+    }
+  }
+
+  // slide the window by one bucket, the oldest one becomes the current one
+  windowBucketIndex = (windowBucketIndex + 1) % WINDOW_BUCKET_COUNT;
+  windowPulseCount -= windowBuckets[windowBucketIndex];
+  windowBuckets[windowBucketIndex] = 0;
+
+  if (noPulsesFsm != NULL && ++stepsSincePulse >= noPulsesSteps) {
+    noPulsesFsm->postEvent(noPulsesEvent);
+    noPulsesFsm = NULL;
+  }
+
+  // once per window while the pipe fills: it is full when the pulse rate stopped changing
+  if (!thresholdSupervised && windowBucketIndex == 0) {
+    const unsigned int count = windowPulseCount;
+    const unsigned int difference = count > pipeFillPreviousCount ? count - pipeFillPreviousCount : pipeFillPreviousCount - count;
+    if (count > 0 && difference <= count / PIPE_FILL_TOLERANCE_DIVISOR) {
+      pipeFillSettledWindows++;
+      if (pipeFillSettledWindows >= PIPE_FILL_SETTLED_WINDOWS) {
+        // the window already holds the settled flow, check it with the next pulse
+        thresholdReported = false;
+        flowBandReported = false;
+        flowBandLowSteps = 0;
+        thresholdSupervised = true;
+      }
+    } else {
+      pipeFillSettledWindows = 0;
+    }
+    pipeFillPreviousCount = count;
   }
 }
 
@@ -6,18 +6,67 @@
 
 #define LIBCALL_DEEP_SLEEP_SCHEDULER
 #include <DeepSleepScheduler.h> // https://github.com/PRosenb/DeepSleepScheduler
+#include "DurationFsm.h"
 #include "Constants.h"
 
 #define VALUES_COUNT 10
+// amount of pulse timestamps kept to calculate the flow, must be smaller than 256
+#define PULSE_TIMES_COUNT 8
+// the threshold window slides in steps of windowMs / WINDOW_BUCKET_COUNT
+#define WINDOW_BUCKET_COUNT 10
+// the pipe is considered full when the pulses of consecutive windows differ by at most 1/PIPE_FILL_TOLERANCE_DIVISOR
+#define PIPE_FILL_TOLERANCE_DIVISOR 8
+// amount of consecutive windows that need to be within the tolerance
+#define PIPE_FILL_SETTLED_WINDOWS 2
+// timer steps the window needs to stay below the flow band before it is reported
+#define FLOW_BAND_LOW_STEPS (2 * WINDOW_BUCKET_COUNT)
+// the idle leak window slides in steps of windowMs / IDLE_LEAK_BUCKET_COUNT
+#define IDLE_LEAK_BUCKET_COUNT 4
 
 // Runnable used to delay threshold
 class WaterMeter: public Runnable {
   public:
-    WaterMeter(const unsigned long invervalMs);
+    /**
+       @param windowMs length of the sliding window the threshold is compared against
+    */
+    WaterMeter(const unsigned long windowMs);
     virtual ~WaterMeter();
     void start();
     void stop();
+    /**
+       The listener is scheduled as soon as samplesInInterval or more pulses are counted within the sliding window.
+    */
     void setThresholdListener(const unsigned int samplesInInterval, Runnable *listener);
+    /**
+       While the threshold is supervised, the listener is scheduled once as soon as the window holds more pulses than
+       maxFlow allows or stayed below minFlow for FLOW_BAND_LOW_STEPS. The band is kept until removeFlowBand().
+       @param minFlow lowest expected flow in pulses per minute
+       @param maxFlow highest expected flow in pulses per minute
+    */
+    void setFlowBand(const unsigned int minFlow, const unsigned int maxFlow, Runnable *listener);
+    void removeFlowBand();
+    /**
+       returns the pulses of the window that left the flow band.
+    */
+    inline unsigned int getLastPulseCountOutOfBand() {
+      return lastPulseCountOutOfBand;
+    }
+    /**
+       The event is posted to the fsm once as soon as the total count reaches pulseCount.
+       Only one pulse count event can be set at a time, setting a new one replaces the previous one.
+    */
+    void setPulseCountEvent(const unsigned long pulseCount, TableDurationFsm *fsm, const byte event);
+    void removePulseCountEvent();
+    /**
+       The event is posted to the fsm once as soon as no pulse was seen for noPulsesMs while started.
+       It is measured in steps of the sliding window. Setting a new one replaces the previous one.
+    */
+    void setNoPulsesEvent(const unsigned long noPulsesMs, TableDurationFsm *fsm, const byte event);
+    void removeNoPulsesEvent();
+    /**
+       The threshold is supervised as soon as the pulse rate settled after the pipe filled up,
+       at the latest thresholdSupervisionDelay after start.
+    */
     inline void setThresholdSupervisionDelay(const unsigned long thresholdSupervisionDelay) {
       WaterMeter::thresholdSupervisionDelay = thresholdSupervisionDelay;
     }
@@ -30,18 +79,111 @@ class WaterMeter: public Runnable {
     inline unsigned int getLastPulseCountOverThreshold() {
       return lastPulseCountOverThreshold;
     }
+    inline bool isThresholdSupervised() {
+      return thresholdSupervised;
+    }
+    /**
+       returns the flow in pulses per minute calculated from the interval between the last two pulses.
+       It decreases if no pulse was seen for longer than that interval. 0 if there are not enough pulses.
+    */
+    unsigned int getInstantaneousFlow();
+    /**
+       returns the flow in pulses per minute averaged over the last PULSE_TIMES_COUNT pulses.
+       It decreases if no pulse was seen for longer than the last interval. 0 if there are not enough pulses.
+    */
+    unsigned int getAveragedFlow();
+    /**
+       Suspends the threshold supervision until the pipe is full again, e.g. after another valve was opened.
+    */
+    void restartThresholdSupervision();
+    /**
+       While stopped, only the pulse interrupt stays armed and the system keeps sleeping. The pulses wake it up shortly
+       to be counted. The listener is scheduled once as soon as pulses or more are counted within the sliding window.
+       It can be reported again after the count went below pulses.
+       @param pulses amount of pulses to report, 0 to stop idle monitoring
+    */
+    void setIdleLeakListener(const unsigned int pulses, const unsigned long windowMs, Runnable *listener);
+    /**
+       Restarts the idle leak window, e.g. after a run ended. Idle monitoring is on after construction.
+    */
+    void startIdleMonitoring();
+    /**
+       Pauses idle monitoring while a run is active, including its pauses with the main valve off.
+    */
+    void stopIdleMonitoring();
+    /**
+       returns the pulses counted while stopped since system start.
+    */
+    inline unsigned long getIdleTotalCount() {
+      return idleTotalCount;
+    }
     void run();
   private:
     static volatile Runnable *listener;
+    static TableDurationFsm * volatile pulseCountFsm;
+    static volatile byte pulseCountEvent;
+    static volatile unsigned long pulseCountEventCount;
+    static TableDurationFsm * volatile noPulsesFsm;
+    static volatile byte noPulsesEvent;
+    // window steps without pulse to post noPulsesEvent after and the ones passed since the last pulse
+    static volatile unsigned int noPulsesSteps;
+    static volatile unsigned int stepsSincePulse;
     static void isrWaterMeterPulses();
     static void isrTimer();
+    static void isrIdlePulses();
+    void disarmIdleMonitoring();
+    void slideIdleWindow();
+    static void startThresholdSupervision();
+    void startPipeFillDetection();
+    unsigned int getFlow(byte intervals);
 
+    const unsigned long windowStepMs;
     bool started;
     unsigned long thresholdSupervisionDelay = 0;
     static volatile unsigned int samplesInInterval;
     static volatile unsigned long totalPulseCount;
-    static volatile unsigned long lastPulseCount;
+    // pulses per step of the sliding window, the bucket at windowBucketIndex is the current one
+    static volatile byte windowBuckets[WINDOW_BUCKET_COUNT];
+    static volatile byte windowBucketIndex;
+    static volatile unsigned int windowPulseCount;
+    static volatile bool thresholdSupervised;
+    static volatile bool thresholdReported;
     static volatile unsigned int lastPulseCountOverThreshold;
+    // the flow band in pulses per window, flowBandListener is NULL if there is none
+    static volatile Runnable *flowBandListener;
+    static volatile unsigned int flowBandMinPulses;
+    static volatile unsigned int flowBandMaxPulses;
+    static volatile byte flowBandLowSteps;
+    static volatile bool flowBandReported;
+    static volatile unsigned int lastPulseCountOutOfBand;
+    // window pulse count of the previous window while the pipe fills
+    static volatile unsigned int pipeFillPreviousCount;
+    static volatile byte pipeFillSettledWindows;
+    // micros() of the latest pulses as ring buffer, written by the pulse ISR only
+    static volatile unsigned long pulseTimesUs[PULSE_TIMES_COUNT];
+    static volatile byte pulseTimesNext;
+    static volatile byte pulseTimesCount;
+
+    static volatile Runnable *idleLeakListener;
+    static volatile unsigned int idleLeakPulses;
+    static volatile unsigned int idleBuckets[IDLE_LEAK_BUCKET_COUNT];
+    static volatile byte idleBucketIndex;
+    static volatile unsigned int idleWindowPulseCount;
+    static volatile bool idleLeakReported;
+    static volatile unsigned long idleTotalCount;
+    unsigned long idleWindowStepMs;
+    bool idleMonitoring;
+    /**
+      Slides the idle leak window, wakes the system once per step only.
+    */
+    class IdleWindow: public Runnable {
+      public:
+        IdleWindow(WaterMeter &waterMeter): waterMeter(waterMeter) {}
+        void run();
+      private:
+        WaterMeter &waterMeter;
+    };
+    IdleWindow idleWindow;
 };
 
 #endif
@@ -14,9 +14,20 @@
 
 #include "WaterManager.h"
 #include "SerialManager.h"
+#include "StaticArena.h"
+#include "SerialLog.h"
+#include "ConfigStore.h"
+#include "Debouncer.h"
+#include "RunStats.h"
+#include "WeeklySchedule.h"
+#include "RunLog.h"
 
 SerialManager *serialManager;
 WaterManager *waterManager;
+Debouncer modeDebouncer;
+Debouncer startAutomaticDebouncer;
+// zones of the start time that fired last
+ZoneMask rtcZones = ALL_ZONES;
 
 void setup() {
   if (!superviseCrashResetCount()) {
@@ -24,8 +35,8 @@ void setup() {
     return;
   }
 
-  serialManager = new SerialManager(BLUETOOTH_ENABLE_PIN);
-  waterManager = new WaterManager();
+  serialManager = new (arena) SerialManager(BLUETOOTH_ENABLE_PIN);
+  waterManager = new (arena) WaterManager();
   serialManager->setWaterManager(waterManager);
 
   initRtc();
@@ -53,20 +64,20 @@ void loop() {
 
 class SupervisionCallback: public Runnable {
     void run() {
-      int resetCount = 0;
-      EEPROMwl.get(EEPROM_INDEX_WATCHDOG_RESET_COUNT, resetCount);
-      EEPROMwl.put(EEPROM_INDEX_WATCHDOG_RESET_COUNT, resetCount + 1);
+      config.writeWatchdogResetCount(config.getWatchdogResetCount() + 1);
     }
 };
 
+static_assert(ARENA_SIZEOF(SerialManager) + ARENA_SIZEOF(WaterManager) + WaterManager::ARENA_BYTES + ARENA_SIZEOF(SupervisionCallback) <= ARENA_SIZE,
+              "ARENA_SIZE in Constants.h is too small");
+
 /**
    return false if not too many crash resets, true if system should stop.
 */
 inline bool superviseCrashResetCount() {
-  EEPROMwl.begin(EEPROM_VERSION, EEPROM_INDEX_COUNT, EEPROM_LENGTH_TO_USE);
-  int resetCount = 0;
-  EEPROMwl.get(EEPROM_INDEX_WATCHDOG_RESET_COUNT, resetCount);
-  if (resetCount > MAX_RESET_COUNT) {
+  config.begin();
+  runLog.begin();
+  if (config.getWatchdogResetCount() > MAX_RESET_COUNT) {
     // too many crashes, prevent execution
     pinMode(COLOR_LED_GREEN_PIN, OUTPUT);
     digitalWrite(COLOR_LED_GREEN_PIN, LOW);
@@ -83,7 +94,7 @@ inline bool superviseCrashResetCount() {
     return false;
   } else {
     // no problem, execute as normal
-    scheduler.setSupervisionCallback(new SupervisionCallback());
+    scheduler.setSupervisionCallback(new (arena) SupervisionCallback());
     return true;
   }
 }
@@ -95,6 +106,8 @@ inline void initRtc() {
   // reset alarms if active
   RTC.alarm(ALARM_1);
   RTC.alarm(ALARM_2);
+  weeklySchedule.migrateRtcAlarms();
+  weeklySchedule.programNextAlarm();
   delay(1000);
 
   pinMode(RTC_INT_PIN, INPUT_PULLUP);
@@ -105,12 +118,11 @@ inline void initRtc() {
 // interrupts and their callback methods
 // ----------------------------------------------------------------------------------
 void modeScheduled() {
-  waterManager->modeClicked();
-  serialManager->startSerial();
-
-  // simple debounce
-  delay(200);
-  scheduler.removeCallbacks(modeScheduled);
+  MEASURE_RUN(RUN_STATS_MODE_BUTTON);
+  if (modeDebouncer.accept()) {
+    waterManager->modeClicked();
+    serialManager->startSerial();
+  }
 }
 
 void isrMode() {
@@ -120,19 +132,21 @@ void isrMode() {
 }
 
 void startAutomaticRtc() {
-  Serial.println(F("startAutomaticRtc"));
-  waterManager->startAutomaticRtc();
+  MEASURE_RUN(RUN_STATS_RTC);
+  serialLog.println(F("startAutomaticRtc"));
+  waterManager->startAutomaticRtc(rtcZones);
   serialManager->startSerial();
 }
 
 void rtcScheduled() {
+  MEASURE_RUN(RUN_STATS_RTC);
   //  Serial.println(F("rtcScheduled"));delay(150);
   if (RTC.alarm(ALARM_1)) {
+    rtcZones = weeklySchedule.fire();
     scheduler.schedule(startAutomaticRtc);
   }
-  if (RTC.alarm(ALARM_2)) {
-    scheduler.schedule(startAutomaticRtc);
-  }
+  // not used by the schedule, reset in case it was set by an older version
+  RTC.alarm(ALARM_2);
 }
 
 void isrRtc() {
@@ -140,17 +154,18 @@ void isrRtc() {
 }
 
 void startAutomatic() {
-  Serial.println(F("startAutomatic"));
-  waterManager->startAutomatic();
-  serialManager->startSerial();
-
-  // simple debounce
-  delay(200);
-  scheduler.removeCallbacks(startAutomatic);
+  MEASURE_RUN(RUN_STATS_START_BUTTON);
+  if (startAutomaticDebouncer.accept()) {
+    serialLog.println(F("startAutomatic"));
+    waterManager->startAutomatic();
+    serialManager->startSerial();
+  }
 }
 
 void isrStartAutomatic() {
-  scheduler.schedule(startAutomatic);
+  if (!scheduler.isScheduled(startAutomatic)) {
+    scheduler.schedule(startAutomatic);
+  }
 }
 
 // ----------------------------------------------------------------------------------
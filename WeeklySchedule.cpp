@@ -0,0 +1,203 @@
+
+#include "WeeklySchedule.h"
+#include "ConfigStore.h"
+#include "SerialLog.h"
+#include <DS3232RTC.h>    // http://github.com/JChristensen/DS3232RTC
+
+// DS3232 registers from the seconds of ALARM_1 to the control register
+#define RTC_ALARM_REGISTERS_ADDR 0x07
+#define RTC_ALARM_REGISTERS_LENGTH 8
+#define RTC_ALARM1_MINUTES_OFFSET 1
+#define RTC_ALARM2_MINUTES_OFFSET 4
+#define RTC_CONTROL_OFFSET 7
+// alarm interrupt enable bits of the control register
+#define RTC_CONTROL_A1IE 0x01
+#define RTC_CONTROL_A2IE 0x02
+// mask bit of each alarm register and the day instead of date bit of the day/date register
+#define RTC_ALARM_MASK 0x80
+#define RTC_ALARM_DAY 0x40
+
+WeeklySchedule weeklySchedule;
+
+bool WeeklySchedule::add(byte weekday, byte hour, byte minute, ZoneMask zones) {
+  if (!insert(weekday, hour, minute, zones)) {
+    return false;
+  }
+  changed();
+  return true;
+}
+
+bool WeeklySchedule::insert(byte weekday, byte hour, byte minute, ZoneMask zones) {
+  if (weekday < 1 || weekday > 7 || hour > 23 || minute > 59 || zones == 0) {
+    return false;
+  }
+  ScheduleTable &table = config.getSchedule();
+  const unsigned int minuteOfWeek = (weekday - 1) * MINUTES_PER_DAY + hour * 60U + minute;
+  const byte index = findFirstAfter(minuteOfWeek);
+  if (index > 0 && table.entries[index - 1].minuteOfWeek == minuteOfWeek) {
+    table.entries[index - 1].zones |= zones;
+  } else {
+    if (table.count >= SCHEDULE_MAX_ENTRIES) {
+      return false;
+    }
+    for (byte i = table.count; i > index; i--) {
+      table.entries[i] = table.entries[i - 1];
+    }
+    table.entries[index].minuteOfWeek = minuteOfWeek;
+    table.entries[index].zones = zones;
+    table.count++;
+  }
+  return true;
+}
+
+void WeeklySchedule::migrateRtcAlarms() {
+  if (config.getSchedule().count > 0) {
+    return;
+  }
+  // read all at once, programming the schedule overwrites them
+  byte registers[RTC_ALARM_REGISTERS_LENGTH];
+  RTC.readRTC(RTC_ALARM_REGISTERS_ADDR, registers, RTC_ALARM_REGISTERS_LENGTH);
+  const byte control = registers[RTC_CONTROL_OFFSET];
+  bool migrated = false;
+  if (control & RTC_CONTROL_A1IE) {
+    migrated |= insertRtcAlarm(registers + RTC_ALARM1_MINUTES_OFFSET);
+  }
+  if (control & RTC_CONTROL_A2IE) {
+    migrated |= insertRtcAlarm(registers + RTC_ALARM2_MINUTES_OFFSET);
+  }
+  if (migrated) {
+    serialLog.println(F("RTC alarms migrated to the schedule"));
+    config.scheduleChanged();
+  }
+}
+
+bool WeeklySchedule::insertRtcAlarm(const byte *alarm) {
+  // minutes, hours and day/date in BCD, an alarm matching every minute or hour is not a start time
+  if ((alarm[0] & RTC_ALARM_MASK) || (alarm[1] & RTC_ALARM_MASK)) {
+    return false;
+  }
+  const byte minute = (alarm[0] >> 4) * 10 + (alarm[0] & 0x0F);
+  const byte hour = ((alarm[1] >> 4) & 0x03) * 10 + (alarm[1] & 0x0F);
+  bool inserted = false;
+  if (alarm[2] & RTC_ALARM_MASK) {
+    // daily
+    for (byte weekday = 1; weekday <= 7; weekday++) {
+      inserted |= insert(weekday, hour, minute, ALL_ZONES);
+    }
+  } else if (alarm[2] & RTC_ALARM_DAY) {
+    inserted = insert(alarm[2] & 0x0F, hour, minute, ALL_ZONES);
+  }
+  // a day of the month does not repeat weekly
+  return inserted;
+}
+
+bool WeeklySchedule::remove(byte index) {
+  ScheduleTable &table = config.getSchedule();
+  if (index >= table.count) {
+    return false;
+  }
+  table.count--;
+  for (byte i = index; i < table.count; i++) {
+    table.entries[i] = table.entries[i + 1];
+  }
+  changed();
+  return true;
+}
+
+void WeeklySchedule::clear() {
+  config.getSchedule().count = 0;
+  changed();
+}
+
+ZoneMask WeeklySchedule::fire() {
+  ScheduleTable &table = config.getSchedule();
+  ZoneMask zones = ALL_ZONES;
+  if (table.count > 0) {
+    // the latest start time at or before now, the minute may have passed already when the alarm is handled late
+    const byte index = findFirstAfter(getCurrentMinuteOfWeek());
+    // wraps around to the last entry of the previous week
+    zones = table.entries[(index > 0 ? index : table.count) - 1].zones;
+  }
+  programNextAlarm();
+  return zones;
+}
+
+void WeeklySchedule::programNextAlarm() {
+  // not used by the schedule
+  RTC.alarmInterrupt(ALARM_2, false);
+
+  ScheduleTable &table = config.getSchedule();
+  if (table.count == 0) {
+    RTC.alarmInterrupt(ALARM_1, false);
+    return;
+  }
+  byte index = findFirstAfter(getCurrentMinuteOfWeek());
+  if (index == table.count) {
+    // wrap around to next week
+    index = 0;
+  }
+  const unsigned int minuteOfWeek = table.entries[index].minuteOfWeek;
+  //setAlarm(ALARM_TYPES_t alarmType, byte seconds, byte minutes, byte hours, byte daydate);
+  RTC.setAlarm(ALM1_MATCH_DAY, 0, minuteOfWeek % 60U, (minuteOfWeek % MINUTES_PER_DAY) / 60U, minuteOfWeek / MINUTES_PER_DAY + 1);
+  RTC.alarmInterrupt(ALARM_1, true);
+}
+
+void WeeklySchedule::programTestAlarm() {
+  RTC.setAlarm(ALM1_MATCH_SECONDS, 0, 0, 0, 0);
+  // programNextAlarm() disables it while the schedule is empty
+  RTC.alarmInterrupt(ALARM_1, true);
+}
+
+void WeeklySchedule::printSchedule() {
+  ScheduleTable &table = config.getSchedule();
+  Serial.print(F("Schedule: "));
+  Serial.print(table.count);
+  Serial.print(F(" of "));
+  Serial.println(SCHEDULE_MAX_ENTRIES);
+  for (byte i = 0; i < table.count; i++) {
+    const unsigned int minuteOfWeek = table.entries[i].minuteOfWeek;
+    const unsigned int minuteOfDay = minuteOfWeek % MINUTES_PER_DAY;
+    Serial.print(i);
+    Serial.print(F(": day "));
+    Serial.print(minuteOfWeek / MINUTES_PER_DAY + 1);
+    Serial.print(F(" "));
+    Serial.print(minuteOfDay / 60U);
+    Serial.print(minuteOfDay % 60U < 10 ? F(":0") : F(":"));
+    Serial.print(minuteOfDay % 60U);
+    Serial.print(F(", zones:"));
+    for (byte zone = 0; zone < ZONE_COUNT; zone++) {
+      if (table.entries[i].zones & ((ZoneMask) 1 << zone)) {
+        Serial.print(F(" "));
+        Serial.print(zone + 1);
+      }
+    }
+    Serial.println();
+  }
+}
+
+byte WeeklySchedule::findFirstAfter(unsigned int minuteOfWeek) {
+  const ScheduleTable &table = config.getSchedule();
+  // binary search, the entries are sorted
+  byte low = 0;
+  byte high = table.count;
+  while (low < high) {
+    const byte middle = (low + high) / 2;
+    if (table.entries[middle].minuteOfWeek <= minuteOfWeek) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+unsigned int WeeklySchedule::getCurrentMinuteOfWeek() {
+  // read from the RTC directly as the system time does not advance while sleeping
+  const time_t time = RTC.get();
+  return (weekday(time) - 1) * MINUTES_PER_DAY + hour(time) * 60U + minute(time);
+}
+
+void WeeklySchedule::changed() {
+  config.scheduleChanged();
+  programNextAlarm();
+}
@@ -0,0 +1,74 @@
+#ifndef WEEKLY_SCHEDULE_H
+#define WEEKLY_SCHEDULE_H
+
+#include "Arduino.h"
+#include "Zones.h"
+#include "Constants.h"
+
+#define MINUTES_PER_DAY 1440U
+#define MINUTES_PER_WEEK (7U * MINUTES_PER_DAY)
+
+struct ScheduleEntry {
+  // 0 is Sunday 00:00, the entries are sorted by it and it is unique
+  unsigned int minuteOfWeek;
+  ZoneMask zones;
+};
+
+/**
+   The persisted schedule, kept by ConfigStore.
+*/
+struct ScheduleTable {
+  byte count;
+  ScheduleEntry entries[SCHEDULE_MAX_ENTRIES];
+};
+
+/**
+   Start times per weekday with the zones to water. Only the next start time is programmed to ALARM_1 of the RTC
+   so that the MCU sleeps until then independent of the amount of entries.
+*/
+class WeeklySchedule {
+  public:
+    /**
+       Adds a start time. If there is already one at the same time, the zones are added to it.
+       @param weekday 1 to 7, 1 is Sunday
+       @return false if the schedule is full or the values are invalid
+    */
+    bool add(byte weekday, byte hour, byte minute, ZoneMask zones);
+    /**
+       @param index position of the entry as printed by printSchedule()
+    */
+    bool remove(byte index);
+    void clear();
+    /**
+       Before the schedule existed, ALARM_1 and ALARM_2 of the RTC were daily start times for all zones. Adds the
+       enabled ones to an empty schedule so that an upgraded system keeps watering. Call before programNextAlarm().
+    */
+    void migrateRtcAlarms();
+    /**
+       Called when ALARM_1 fired. Programs the RTC to the next start time.
+       @return the zones of the latest start time at or before now, ALL_ZONES if the schedule is empty
+    */
+    ZoneMask fire();
+    /**
+       Programs ALARM_1 of the RTC to the next start time or disables it if there is none.
+    */
+    void programNextAlarm();
+    /**
+       Programs ALARM_1 of the RTC to the next full minute, also if the schedule is empty. When it fires, all zones
+       start and the schedule programs its next start time again.
+    */
+    void programTestAlarm();
+    void printSchedule();
+  private:
+    bool insert(byte weekday, byte hour, byte minute, ZoneMask zones);
+    // alarm points to the minutes register of an alarm, followed by hours and day/date
+    bool insertRtcAlarm(const byte *alarm);
+    // index of the first entry after minuteOfWeek, count if there is none
+    byte findFirstAfter(unsigned int minuteOfWeek);
+    unsigned int getCurrentMinuteOfWeek();
+    void changed();
+};
+
+extern WeeklySchedule weeklySchedule;
+
+#endif
@@ -0,0 +1,51 @@
+#include "ZoneFlow.h"
+
+static unsigned int squareRoot(unsigned long value) {
+  unsigned long root = 0;
+  unsigned long bit = 1UL << 30;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+void addZoneFlow(ZoneFlow &zoneFlow, unsigned int flow) {
+  if (flow == 0) {
+    return;
+  }
+  if (zoneFlow.runs == 0) {
+    zoneFlow.mean = flow;
+    zoneFlow.variance = 0;
+    zoneFlow.runs = 1;
+    return;
+  }
+  const long difference = (long) flow - zoneFlow.mean;
+  const unsigned long magnitude = difference < 0 ? -difference : difference;
+  const unsigned long squared = magnitude * magnitude;
+  zoneFlow.mean += difference / ZONE_FLOW_WEIGHT_DIVISOR;
+  // exponentially weighted variance: (1 - w) * (variance + w * difference^2)
+  unsigned long variance = (zoneFlow.variance + squared / ZONE_FLOW_WEIGHT_DIVISOR / ZONE_FLOW_VARIANCE_UNIT)
+                           * (ZONE_FLOW_WEIGHT_DIVISOR - 1) / ZONE_FLOW_WEIGHT_DIVISOR;
+  zoneFlow.variance = variance < 0xFFFF ? variance : 0xFFFF;
+  if (zoneFlow.runs < 255) {
+    zoneFlow.runs++;
+  }
+}
+
+unsigned int getZoneFlowTolerance(unsigned int mean, unsigned long variance) {
+  const unsigned long tolerance = (unsigned long) ZONE_FLOW_TOLERANCE_SIGMAS * squareRoot(variance * ZONE_FLOW_VARIANCE_UNIT);
+  const unsigned int minTolerance = mean / ZONE_FLOW_MIN_TOLERANCE_DIVISOR;
+  if (tolerance < minTolerance) {
+    return minTolerance;
+  }
+  return tolerance < 0xFFFF ? tolerance : 0xFFFF;
+}
@@ -0,0 +1,54 @@
+#ifndef ZONE_FLOW_H
+#define ZONE_FLOW_H
+
+#include "Arduino.h"
+#include "Constants.h"
+
+// resolution of the stored variance in (pulses per minute)^2
+#define ZONE_FLOW_VARIANCE_UNIT 16
+// a new run is weighted 1 / ZONE_FLOW_WEIGHT_DIVISOR, the older ones together the rest
+#define ZONE_FLOW_WEIGHT_DIVISOR 4
+// runs needed before the flow of a zone is supervised
+#define ZONE_FLOW_MIN_RUNS 3
+// the flow may deviate from the mean by this many standard deviations
+#define ZONE_FLOW_TOLERANCE_SIGMAS 4
+// but at least by mean / ZONE_FLOW_MIN_TOLERANCE_DIVISOR as the supply pressure varies more than a few runs show
+#define ZONE_FLOW_MIN_TOLERANCE_DIVISOR 4
+
+/**
+   Flow of a zone learned over its runs as stored in EEPROM.
+*/
+struct ZoneFlow {
+  // pulses per minute, 0 if unknown
+  unsigned int mean;
+  // in ZONE_FLOW_VARIANCE_UNIT, saturates at 65535
+  unsigned int variance;
+  // saturates at 255
+  byte runs;
+};
+
+/**
+   The learned flows of all zones, kept by ConfigStore.
+*/
+struct ZoneFlowTable {
+  ZoneFlow zones[ZONE_COUNT];
+};
+
+/**
+   Adds the flow of one run, the weight of the older runs decreases exponentially.
+   @param flow averaged flow of the run in pulses per minute, ignored if 0
+*/
+void addZoneFlow(ZoneFlow &zoneFlow, unsigned int flow);
+
+/**
+   @param mean sum of the means of the zones watered together in pulses per minute
+   @param variance sum of their variances in ZONE_FLOW_VARIANCE_UNIT
+   @return how far the flow may deviate from mean in pulses per minute
+*/
+unsigned int getZoneFlowTolerance(unsigned int mean, unsigned long variance);
+
+inline bool isZoneFlowLearned(const ZoneFlow &zoneFlow) {
+  return zoneFlow.runs >= ZONE_FLOW_MIN_RUNS;
+}
+
+#endif
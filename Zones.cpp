@@ -0,0 +1,10 @@
+
+#include "Zones.h"
+#include "ConfigStore.h"
+
+// Add one line per zone and set ZONE_COUNT in Constants.h accordingly.
+const ZoneDescriptor zoneDescriptors[] PROGMEM = {
+  {VALVE2_PIN, DEFAULT_DURATION_AUTOMATIC1_SEC},
+  {VALVE3_PIN, DEFAULT_DURATION_AUTOMATIC2_SEC},
+  {VALVE4_PIN, DEFAULT_DURATION_AUTOMATIC3_SEC}
+};
@@ -0,0 +1,57 @@
+#ifndef ZONES_H
+#define ZONES_H
+
+#include "Arduino.h"
+#include "Constants.h"
+
+/**
+   Compact description of a watering zone. The zones are watered in the order of zoneDescriptors.
+   The settings of a zone are kept by ConfigStore, the state by ValveManager.
+*/
+struct ZoneDescriptor {
+  // PIN of the zone valve
+  byte pin;
+  unsigned int defaultDurationSec;
+};
+
+/**
+   Settings of a zone as stored in EEPROM.
+*/
+struct ZoneSettings {
+  unsigned int durationSec;
+  // litres after which the zone is stopped, 0 to water for the duration only
+  unsigned int volumeLitres;
+};
+
+/**
+   The settings of all zones, kept by ConfigStore in one EEPROM index.
+*/
+struct ZoneSettingsTable {
+  ZoneSettings zones[ZONE_COUNT];
+};
+
+// one bit per zone, bit 0 is the first zone
+#if ZONE_COUNT <= 8
+typedef byte ZoneMask;
+#elif ZONE_COUNT <= 16
+typedef unsigned int ZoneMask;
+#else
+typedef unsigned long ZoneMask;
+#endif
+#define ALL_ZONES ((ZoneMask) ((1ULL << ZONE_COUNT) - 1))
+
+// defined in Zones.cpp, one entry per zone
+extern const ZoneDescriptor zoneDescriptors[ZONE_COUNT] PROGMEM;
+
+/**
+   @param zoneIndex index of the zone, 0 to ZONE_COUNT - 1
+*/
+inline byte getZonePin(const byte zoneIndex) {
+  return pgm_read_byte(&zoneDescriptors[zoneIndex].pin);
+}
+
+inline unsigned int getZoneDefaultDurationSec(const byte zoneIndex) {
+  return pgm_read_word(&zoneDescriptors[zoneIndex].defaultDurationSec);
+}
+
+#endif
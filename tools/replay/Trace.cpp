@@ -0,0 +1,69 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+bool readTrace(const char *fileName, Trace &trace) {
+  std::ifstream file(fileName);
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", fileName);
+    return false;
+  }
+  trace.name = fileName;
+  trace.path = PATH_RUN;
+  memset(&trace.baseline, 0, sizeof(trace.baseline));
+  trace.anomalyUs = NO_ANOMALY;
+  trace.endUs = 0;
+  std::string line;
+  for (unsigned int lineNumber = 1; std::getline(file, line); lineNumber++) {
+    std::istringstream input(line);
+    std::string first;
+    if (!(input >> first) || first[0] == '#') {
+      continue;
+    }
+    std::string value;
+    if (first == "path" && input >> value) {
+      trace.path = value == "automatic" ? PATH_AUTOMATIC : PATH_RUN;
+    } else if (first == "baseline" && input >> value) {
+      double deviation = 0;
+      input >> deviation;
+      trace.baseline.mean = atoi(value.c_str());
+      trace.baseline.variance = (unsigned int) (deviation * deviation / ZONE_FLOW_VARIANCE_UNIT);
+      trace.baseline.runs = ZONE_FLOW_MIN_RUNS;
+    } else if (first == "anomaly" && input >> value) {
+      trace.anomalyUs = (unsigned long) (atof(value.c_str()) * 1000.0);
+    } else if (first == "end" && input >> value) {
+      trace.endUs = (unsigned long) (atof(value.c_str()) * 1000.0);
+    } else if (isdigit(first[0])) {
+      const double startMs = atof(first.c_str());
+      unsigned long count = 1;
+      double intervalMs = 0;
+      input >> count >> intervalMs;
+      for (unsigned long i = 0; i < count; i++) {
+        trace.pulsesUs.push_back((unsigned long) ((startMs + i * intervalMs) * 1000.0));
+      }
+    } else {
+      fprintf(stderr, "%s:%u: cannot read '%s'\n", fileName, lineNumber, line.c_str());
+      return false;
+    }
+  }
+  std::sort(trace.pulsesUs.begin(), trace.pulsesUs.end());
+  if (trace.endUs == 0) {
+    trace.endUs = (trace.pulsesUs.empty() ? 0 : trace.pulsesUs.back()) + 1000000UL;
+  }
+  return true;
+}
+
+unsigned long countPulses(const Trace &trace, unsigned long fromUs, unsigned long toUs) {
+  unsigned long count = 0;
+  for (size_t i = 0; i < trace.pulsesUs.size(); i++) {
+    if (trace.pulsesUs[i] >= fromUs && trace.pulsesUs[i] < toUs) {
+      count++;
+    }
+  }
+  return count;
+}
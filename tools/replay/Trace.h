@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "VirtualArduino.h"
+#include "ZoneFlow.h"
+
+#include <climits>
+#include <string>
+#include <vector>
+
+#define PATH_RUN 0
+#define PATH_AUTOMATIC 1
+#define NO_ANOMALY ULONG_MAX
+
+/**
+   A recorded pulse trace, see replay.cpp for the file format.
+*/
+struct Trace {
+  std::string name;
+  byte path;
+  // runs is 0 without baseline
+  ZoneFlow baseline;
+  unsigned long anomalyUs;
+  unsigned long endUs;
+  std::vector<unsigned long> pulsesUs;
+};
+
+/**
+   returns false and prints the reason to stderr if the file cannot be read.
+*/
+bool readTrace(const char *fileName, Trace &trace);
+/**
+   returns the pulses of the trace from fromUs up to but not including toUs.
+*/
+unsigned long countPulses(const Trace &trace, unsigned long fromUs, unsigned long toUs);
+
+/**
+   The recorded pulses of a trace, delayed by offsetUs.
+*/
+class TracePulses: public PulseSource {
+  public:
+    TracePulses(const Trace &trace, unsigned long offsetUs = 0): trace(trace), offsetUs(offsetUs), nextPulse(0) {}
+    unsigned long getNextPulseUs() {
+      return nextPulse < trace.pulsesUs.size() ? trace.pulsesUs[nextPulse] + offsetUs : ULONG_MAX;
+    }
+    void next() {
+      nextPulse++;
+    }
+  private:
+    const Trace &trace;
+    const unsigned long offsetUs;
+    size_t nextPulse;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include "VirtualArduino.h"
+#include "Constants.h"
+#include <DeepSleepScheduler.h>
+#include <MsTimer2.h>
+#include <EnableInterrupt.h>
+#include <DS3232RTC.h>
+#include <cstdarg>
+#include <climits>
+#include <cstdio>
+#include <vector>
+
+#define PIN_COUNT 32
+
+unsigned long virtualMicros = 0;
+bool serialVerbose = false;
+VirtualStats virtualStats;
+
+HardwareSerial Serial;
+Scheduler scheduler;
+
+static uint8_t pinStates[PIN_COUNT];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP) {
+    pinStates[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  pinStates[pin] = value;
+}
+
+int digitalRead(uint8_t pin) {
+  return pinStates[pin];
+}
+void analogWrite(uint8_t, int) {}
+void noInterrupts() {}
+void interrupts() {}
+
+unsigned long millis() {
+  return virtualMicros / 1000UL;
+}
+
+unsigned long micros() {
+  return virtualMicros;
+}
+
+void delay(unsigned long ms) {
+  virtualMicros += ms * 1000UL;
+}
+
+// ----------------------------------------------------------------------------------
+// Print
+// ----------------------------------------------------------------------------------
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t written = 0;
+  while (size-- > 0) {
+    written += write(*buffer++);
+  }
+  return written;
+}
+
+static size_t printFormatted(Print &print, const char *format, ...) {
+  char buffer[32];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(buffer, sizeof(buffer), format, arguments);
+  va_end(arguments);
+  return print.write(buffer);
+}
+
+size_t Print::print(const __FlashStringHelper *text) {
+  return write((const char *) text);
+}
+size_t Print::print(const char text[]) {
+  return write(text);
+}
+size_t Print::print(char value) {
+  return write((uint8_t) value);
+}
+size_t Print::print(unsigned char value, int base) {
+  return print((unsigned long) value, base);
+}
+size_t Print::print(int value, int base) {
+  return print((long) value, base);
+}
+size_t Print::print(unsigned int value, int base) {
+  return print((unsigned long) value, base);
+}
+size_t Print::print(long value, int base) {
+  return base == HEX ? printFormatted(*this, "%lx", value) : printFormatted(*this, "%ld", value);
+}
+size_t Print::print(unsigned long value, int base) {
+  return base == HEX ? printFormatted(*this, "%lx", value) : printFormatted(*this, "%lu", value);
+}
+size_t Print::print(double value, int digits) {
+  return printFormatted(*this, "%.*f", digits, value);
+}
+size_t Print::println(const __FlashStringHelper *text) {
+  return print(text) + println();
+}
+size_t Print::println(const char text[]) {
+  return print(text) + println();
+}
+size_t Print::println(char value) {
+  return print(value) + println();
+}
+size_t Print::println(unsigned char value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(int value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(unsigned int value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(long value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(unsigned long value, int base) {
+  return print(value, base) + println();
+}
+size_t Print::println(double value, int digits) {
+  return print(value, digits) + println();
+}
+size_t Print::println() {
+  return write('\n');
+}
+
+int HardwareSerial::availableForWrite() {
+  // written immediately
+  return SERIAL_TX_BUFFER_SIZE - 1;
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+  if (serialVerbose) {
+    fputc(value, stderr);
+  }
+  return 1;
+}
+
+// ----------------------------------------------------------------------------------
+// scheduler, callbacks at the same time run in the order they were scheduled
+// ----------------------------------------------------------------------------------
+struct Task {
+  unsigned long timeUs;
+  Runnable *runnable;
+};
+static std::vector<Task> tasks;
+static unsigned int noSleepLockCount = 0;
+
+void Scheduler::schedule(Runnable *runnable) {
+  scheduleDelayed(runnable, 0);
+}
+
+void Scheduler::scheduleDelayed(Runnable *runnable, unsigned long delayMs) {
+  Task task = {virtualMicros + delayMs * 1000UL, runnable};
+  std::vector<Task>::iterator position = tasks.begin();
+  while (position != tasks.end() && position->timeUs <= task.timeUs) {
+    ++position;
+  }
+  tasks.insert(position, task);
+}
+
+void Scheduler::removeCallbacks(Runnable *runnable) {
+  for (std::vector<Task>::iterator task = tasks.begin(); task != tasks.end();) {
+    task = task->runnable == runnable ? tasks.erase(task) : task + 1;
+  }
+}
+
+void Scheduler::acquireNoSleepLock() {
+  noSleepLockCount++;
+}
+
+void Scheduler::releaseNoSleepLock() {
+  if (noSleepLockCount > 0) {
+    noSleepLockCount--;
+  }
+}
+
+bool Scheduler::isScheduled(Runnable *runnable) const {
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (tasks[i].runnable == runnable) {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned long Scheduler::getMillis() const {
+  return millis();
+}
+
+unsigned long Scheduler::getNextTimeUs() const {
+  return tasks.empty() ? ULONG_MAX : tasks.front().timeUs;
+}
+
+void Scheduler::runNext() {
+  Runnable *runnable = tasks.front().runnable;
+  tasks.erase(tasks.begin());
+  virtualStats.callbacks++;
+  runnable->run();
+}
+
+void Scheduler::clear() {
+  tasks.clear();
+  noSleepLockCount = 0;
+}
+
+// ----------------------------------------------------------------------------------
+// MsTimer2
+// ----------------------------------------------------------------------------------
+static unsigned long timerPeriodUs;
+static void (*timerFunction)();
+static bool timerRunning = false;
+static unsigned long timerNextUs;
+
+void MsTimer2::set(unsigned long ms, void (*function)()) {
+  timerPeriodUs = ms * 1000UL;
+  timerFunction = function;
+}
+
+void MsTimer2::start() {
+  timerRunning = true;
+  timerNextUs = virtualMicros + timerPeriodUs;
+}
+
+void MsTimer2::stop() {
+  timerRunning = false;
+}
+
+unsigned long MsTimer2::getNextTimeUs() {
+  return timerRunning ? timerNextUs : ULONG_MAX;
+}
+
+void MsTimer2::fire() {
+  timerNextUs += timerPeriodUs;
+  timerFunction();
+}
+
+// ----------------------------------------------------------------------------------
+// pin interrupts
+// ----------------------------------------------------------------------------------
+static void (*interruptHandlers[PIN_COUNT])();
+
+void enableInterrupt(uint8_t pin, void (*handler)(), uint8_t) {
+  interruptHandlers[pin] = handler;
+}
+
+void disableInterrupt(uint8_t pin) {
+  interruptHandlers[pin] = NULL;
+}
+
+bool triggerInterrupt(uint8_t pin) {
+  if (interruptHandlers[pin] == NULL) {
+    return false;
+  }
+  interruptHandlers[pin]();
+  return true;
+}
+
+// ----------------------------------------------------------------------------------
+// event loop
+// ----------------------------------------------------------------------------------
+void runVirtualArduino(PulseSource &pulses, unsigned long endUs, bool (*until)()) {
+  while (true) {
+    const unsigned long pulseUs = pulses.getNextPulseUs();
+    const unsigned long timerUs = MsTimer2::getNextTimeUs();
+    const unsigned long alarmUs = RTC.getNextAlarmUs();
+    const unsigned long taskUs = scheduler.getNextTimeUs();
+    unsigned long timeUs = pulseUs < timerUs ? pulseUs : timerUs;
+    if (alarmUs < timeUs) {
+      timeUs = alarmUs;
+    }
+    if (taskUs < timeUs) {
+      timeUs = taskUs;
+    }
+    if (timeUs == ULONG_MAX || timeUs > endUs) {
+      if (endUs != ULONG_MAX && endUs > virtualMicros) {
+        if (noSleepLockCount > 0) {
+          virtualStats.awakeUs += endUs - virtualMicros;
+        }
+        virtualMicros = endUs;
+      }
+      return;
+    }
+    if (timeUs > virtualMicros) {
+      if (noSleepLockCount > 0) {
+        virtualStats.awakeUs += timeUs - virtualMicros;
+      } else {
+        // nothing kept the system awake, the event wakes it from deep sleep
+        virtualStats.wakeups++;
+      }
+      virtualMicros = timeUs;
+    }
+    if (pulseUs == timeUs) {
+      // pulses while the interrupt is disabled are not seen by the firmware
+      triggerInterrupt(WATER_METER_PIN);
+      pulses.next();
+    } else if (timerUs == timeUs) {
+      MsTimer2::fire();
+    } else if (alarmUs == timeUs) {
+      if (RTC.fireAlarms()) {
+        triggerInterrupt(RTC_INT_PIN);
+      }
+    } else {
+      scheduler.runNext();
+    }
+    if (until != NULL && until()) {
+      return;
+    }
+  }
+}
+
+void resetVirtualArduino() {
+  virtualMicros = 0;
+  memset(&virtualStats, 0, sizeof(virtualStats));
+  scheduler.clear();
+  timerRunning = false;
+  for (byte i = 0; i < PIN_COUNT; i++) {
+    interruptHandlers[i] = NULL;
+    pinStates[i] = LOW;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef VIRTUAL_ARDUINO_H
+#define VIRTUAL_ARDUINO_H
+
+#include <Arduino.h>
+#include <time.h>
+
+// time of the virtual clock in us, micros(), millis() and the scheduler use it
+extern unsigned long virtualMicros;
+// print the serial output of the firmware to stderr
+extern bool serialVerbose;
+
+struct VirtualStats {
+  // the system woke up from deep sleep, i.e. an event while no no-sleep lock was held
+  unsigned long wakeups;
+  unsigned long callbacks;
+  // time a no-sleep lock was held
+  unsigned long awakeUs;
+};
+extern VirtualStats virtualStats;
+
+/**
+   Source of the water meter pulses, the recorded trace of replay or the flow model of simulate.
+*/
+class PulseSource {
+  public:
+    virtual ~PulseSource() {}
+    /**
+       returns the virtual time in us of the next pulse, ULONG_MAX if none.
+       Called after every event so that it can follow the valves.
+    */
+    virtual unsigned long getNextPulseUs() = 0;
+    /**
+       the pulse returned by getNextPulseUs() happened.
+    */
+    virtual void next() = 0;
+};
+
+/**
+   delivers pulses, RTC alarms, timer interrupts and scheduler callbacks in the order of their virtual time
+   up to endUs. Interrupts go first if they happen at the same time as a callback.
+   The clock is at endUs afterwards if it is not ULONG_MAX.
+   @param until returns early with the clock at the event after which it returned true, NULL to run up to endUs
+*/
+void runVirtualArduino(PulseSource &pulses, unsigned long endUs, bool (*until)() = NULL);
+
+/**
+   sets the clock and the stats to 0 and removes all callbacks, timers, interrupt handlers and pin states.
+*/
+void resetVirtualArduino();
+/**
+   erases the EEPROM and the values of EEPROMwl, see VirtualEeprom.cpp.
+*/
+void resetVirtualEeprom();
+/**
+   sets RTC and system time at the current virtual time and clears the alarms, see VirtualRtc.cpp.
+*/
+void resetVirtualRtc(time_t time);
+
+#endif
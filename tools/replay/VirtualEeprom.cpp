@@ -0,0 +1,61 @@
+#include "VirtualArduino.h"
+#include <EEPROM.h>
+#include <EEPROMWearLevel.h>
+
+EEPROMClass EEPROM;
+EEPROMWearLevel EEPROMwl;
+
+// erased EEPROM reads 0xFF
+static uint8_t eeprom[E2END + 1];
+
+uint8_t EEPROMClass::read(int address) {
+  return eeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  eeprom[address] = value;
+  writeCount++;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+  if (eeprom[address] != value) {
+    write(address, value);
+  }
+}
+
+void EEPROMWearLevel::begin(byte layoutVersion, int amountOfIndexes, int eepromLengthToUse) {
+  int lengths[EEPROM_WEAR_LEVEL_MAX_INDEXES];
+  for (int i = 0; i < amountOfIndexes; i++) {
+    // without the header byte
+    lengths[i] = (eepromLengthToUse - 1) / amountOfIndexes;
+  }
+  begin(layoutVersion, lengths, amountOfIndexes);
+}
+
+void EEPROMWearLevel::begin(byte layoutVersion, const int lengths[], int amountOfIndexes) {
+  if (amountOfIndexes > EEPROM_WEAR_LEVEL_MAX_INDEXES) {
+    abort();
+  }
+  // like the library, the layout version is the first byte and a new layout starts without values
+  if (EEPROM.read(0) != layoutVersion) {
+    memset(indexes, 0, sizeof(indexes));
+    EEPROM.update(0, layoutVersion);
+  }
+  for (int i = 0; i < amountOfIndexes; i++) {
+    // one control bit per data byte
+    indexes[i].maxDataLength = lengths[i] - (lengths[i] + 8) / 9;
+    if (indexes[i].maxDataLength > EEPROM_WEAR_LEVEL_MAX_LENGTH) {
+      abort();
+    }
+  }
+}
+
+int EEPROMWearLevel::getMaxDataLength(int index) {
+  return indexes[index].maxDataLength;
+}
+
+void resetVirtualEeprom() {
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  EEPROM.writeCount = 0;
+  memset(&EEPROMwl, 0, sizeof(EEPROMwl));
+}
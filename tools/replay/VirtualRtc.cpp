@@ -0,0 +1,282 @@
+#include "VirtualArduino.h"
+#include <DS3232RTC.h>
+#include <climits>
+
+#define ALARM1_SECONDS 0x07
+#define ALARM2_MINUTES 0x0B
+#define CONTROL 0x0E
+#define STATUS 0x0F
+#define REGISTER_COUNT 0x14
+#define ALARM_MASK 0x80
+#define ALARM_DAY 0x40
+#define CONTROL_INTCN 0x04
+#define SECONDS_PER_DAY 86400UL
+#define US_PER_SECOND 1000000UL
+
+DS3232RTC RTC;
+
+// RTC and system time at virtual time 0
+static time_t rtcStart;
+static time_t systemStart;
+static byte registers[REGISTER_COUNT];
+// virtual time of the next match per alarm, recalculated when the registers or the time change
+static unsigned long nextAlarmUs[2];
+
+static byte toBcd(byte value) {
+  return (value / 10) << 4 | value % 10;
+}
+
+static byte fromBcd(byte value) {
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+static time_t virtualSeconds() {
+  return virtualMicros / US_PER_SECOND;
+}
+
+static bool matches(byte alarm, time_t time) {
+  // minutes, hours and day/date registers of the alarm
+  const byte *values = &registers[alarm == 0 ? ALARM1_SECONDS + 1 : ALARM2_MINUTES];
+  struct tm elements;
+  gmtime_r(&time, &elements);
+  if (!(values[0] & ALARM_MASK) && fromBcd(values[0] & 0x7F) != elements.tm_min) {
+    return false;
+  }
+  if (!(values[1] & ALARM_MASK) && fromBcd(values[1] & 0x3F) != elements.tm_hour) {
+    return false;
+  }
+  if (!(values[2] & ALARM_MASK)) {
+    if (values[2] & ALARM_DAY) {
+      return (values[2] & 0x0F) == elements.tm_wday + 1;
+    }
+    return fromBcd(values[2] & 0x3F) == elements.tm_mday;
+  }
+  return true;
+}
+
+static void calculateNextAlarms() {
+  for (byte alarm = 0; alarm < 2; alarm++) {
+    nextAlarmUs[alarm] = ULONG_MAX;
+    byte second = 0;
+    if (alarm == 0) {
+      if (registers[ALARM1_SECONDS] & ALARM_MASK) {
+        // every second is not supported
+        continue;
+      }
+      second = fromBcd(registers[ALARM1_SECONDS]);
+    }
+    // minute by minute, a weekly alarm matches within 8 days
+    const time_t nowTime = rtcStart + virtualSeconds();
+    time_t minuteStart = nowTime - nowTime % 60;
+    for (unsigned long i = 0; i <= 8 * 24 * 60; i++, minuteStart += 60) {
+      const time_t time = minuteStart + second;
+      if (time > nowTime && matches(alarm, time)) {
+        nextAlarmUs[alarm] = (time - rtcStart) * US_PER_SECOND;
+        break;
+      }
+    }
+  }
+}
+
+time_t DS3232RTC::get() {
+  return rtcStart + virtualSeconds();
+}
+
+byte DS3232RTC::set(time_t time) {
+  rtcStart = time - virtualSeconds();
+  calculateNextAlarms();
+  return 0;
+}
+
+byte DS3232RTC::read(tmElements_t &elements) {
+  breakTime(get(), elements);
+  return 0;
+}
+
+byte DS3232RTC::write(tmElements_t &elements) {
+  return set(makeTime(elements));
+}
+
+void DS3232RTC::setAlarm(ALARM_TYPES_t alarmType, byte seconds, byte minutes, byte hours, byte daydate) {
+  // as the library does it
+  seconds = toBcd(seconds);
+  minutes = toBcd(minutes);
+  hours = toBcd(hours);
+  daydate = toBcd(daydate);
+  if (alarmType & 0x01) {
+    seconds |= ALARM_MASK;
+  }
+  if (alarmType & 0x02) {
+    minutes |= ALARM_MASK;
+  }
+  if (alarmType & 0x04) {
+    hours |= ALARM_MASK;
+  }
+  if (alarmType & 0x10) {
+    daydate |= ALARM_DAY;
+  }
+  if (alarmType & 0x08) {
+    daydate |= ALARM_MASK;
+  }
+  byte address = ALARM2_MINUTES;
+  if (!(alarmType & 0x80)) {
+    address = ALARM1_SECONDS;
+    writeRTC(address++, seconds);
+  }
+  writeRTC(address++, minutes);
+  writeRTC(address++, hours);
+  writeRTC(address, daydate);
+}
+
+void DS3232RTC::alarmInterrupt(byte alarmNumber, bool alarmEnabled) {
+  byte control = readRTC(CONTROL);
+  if (alarmEnabled) {
+    control |= CONTROL_INTCN | (1 << (alarmNumber - 1));
+  } else {
+    control &= ~(1 << (alarmNumber - 1));
+  }
+  writeRTC(CONTROL, control);
+}
+
+bool DS3232RTC::alarm(byte alarmNumber) {
+  const byte flag = 1 << (alarmNumber - 1);
+  const bool fired = registers[STATUS] & flag;
+  registers[STATUS] &= ~flag;
+  return fired;
+}
+
+byte DS3232RTC::readRTC(byte address, byte *values, byte length) {
+  for (byte i = 0; i < length; i++) {
+    values[i] = readRTC(address + i);
+  }
+  return 0;
+}
+
+byte DS3232RTC::readRTC(byte address) {
+  return address < REGISTER_COUNT ? registers[address] : 0;
+}
+
+byte DS3232RTC::writeRTC(byte address, byte *values, byte length) {
+  for (byte i = 0; i < length; i++) {
+    writeRTC(address + i, values[i]);
+  }
+  return 0;
+}
+
+byte DS3232RTC::writeRTC(byte address, byte value) {
+  if (address < REGISTER_COUNT) {
+    registers[address] = value;
+    calculateNextAlarms();
+  }
+  return 0;
+}
+
+unsigned long DS3232RTC::getNextAlarmUs() {
+  return nextAlarmUs[0] < nextAlarmUs[1] ? nextAlarmUs[0] : nextAlarmUs[1];
+}
+
+bool DS3232RTC::fireAlarms() {
+  bool interrupt = false;
+  for (byte alarm = 0; alarm < 2; alarm++) {
+    if (nextAlarmUs[alarm] <= virtualMicros) {
+      registers[STATUS] |= 1 << alarm;
+      interrupt |= (registers[CONTROL] & (1 << alarm)) != 0;
+    }
+  }
+  calculateNextAlarms();
+  return interrupt;
+}
+
+void resetVirtualRtc(time_t time) {
+  memset(registers, 0, sizeof(registers));
+  // the alarm registers are undefined after power up, these never match
+  registers[ALARM1_SECONDS] = ALARM_MASK;
+  rtcStart = time - virtualSeconds();
+  systemStart = rtcStart;
+  calculateNextAlarms();
+}
+
+// ----------------------------------------------------------------------------------
+// Time library
+// ----------------------------------------------------------------------------------
+time_t now() {
+  return systemStart + virtualSeconds();
+}
+
+void setTime(time_t time) {
+  systemStart = time - virtualSeconds();
+}
+
+void setTime(int hour, int minute, int second, int day, int month, int year) {
+  tmElements_t elements;
+  elements.Hour = hour;
+  elements.Minute = minute;
+  elements.Second = second;
+  elements.Day = day;
+  elements.Month = month;
+  elements.Year = year > 99 ? year - 1970 : year + 30;
+  setTime(makeTime(elements));
+}
+
+void setSyncProvider(getExternalTime provider) {
+  setTime(provider());
+}
+
+void breakTime(time_t time, tmElements_t &elements) {
+  struct tm values;
+  gmtime_r(&time, &values);
+  elements.Second = values.tm_sec;
+  elements.Minute = values.tm_min;
+  elements.Hour = values.tm_hour;
+  elements.Wday = values.tm_wday + 1;
+  elements.Day = values.tm_mday;
+  elements.Month = values.tm_mon + 1;
+  elements.Year = values.tm_year - 70;
+}
+
+time_t makeTime(const tmElements_t &elements) {
+  struct tm values;
+  memset(&values, 0, sizeof(values));
+  values.tm_sec = elements.Second;
+  values.tm_min = elements.Minute;
+  values.tm_hour = elements.Hour;
+  values.tm_mday = elements.Day;
+  values.tm_mon = elements.Month - 1;
+  values.tm_year = elements.Year + 70;
+  return timegm(&values);
+}
+
+int year(time_t time) {
+  tmElements_t elements;
+  breakTime(time, elements);
+  return elements.Year + 1970;
+}
+
+int month(time_t time) {
+  tmElements_t elements;
+  breakTime(time, elements);
+  return elements.Month;
+}
+
+int day(time_t time) {
+  tmElements_t elements;
+  breakTime(time, elements);
+  return elements.Day;
+}
+
+int hour(time_t time) {
+  return time % SECONDS_PER_DAY / 3600;
+}
+
+int minute(time_t time) {
+  return time % 3600 / 60;
+}
+
+int second(time_t time) {
+  return time % 60;
+}
+
+int weekday(time_t time) {
+  // 1970-01-01 was a Thursday
+  return (time / SECONDS_PER_DAY + 4) % 7 + 1;
+}
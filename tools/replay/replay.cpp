@@ -0,0 +1,214 @@
+/*
+  Replays recorded water meter pulses against the firmware in virtual time and reports how fast and how reliably
+  it detects a problem. WaterManager, ValveManager, WaterMeter and their helpers are compiled unchanged from the
+  sketch, every pulse of the trace calls the pulse interrupt of WaterMeter and MsTimer2 calls WaterMeter::isrTimer().
+
+  usage: replay [-v] [-t threshold] trace...
+    -v  print the serial output of the firmware to stderr
+    -t  stop threshold in pulses per window instead of DEFAULT_WATER_METER_STOP_THRESHOLD
+
+  A trace is a text file with one entry per line, times in ms since the run started:
+    # comment
+    path run|automatic          run: the first zone is watered directly as with the start button (default)
+                                automatic: the first zone is watered as on a start time of the schedule, starting
+                                with the leak check and the warning with the water meter check
+    baseline <mean> <deviation> learned flow of the zone in pulses per minute, the flow band is supervised with it
+                                like with ZONE_FLOW_SUPERVISION, omit it for a zone that is not learned yet
+    anomaly <ms>                when the problem starts, omit it for traces without problem
+    end <ms>                    end of the trace, default is one second after the last pulse
+    <ms>                        one pulse
+    <ms> <count> <interval ms>  count pulses, the first one at ms
+
+  The detection is the end reason of the run as it is written to the run log. Every trace runs in its own process
+  as the firmware keeps its state in globals and the arena.
+*/
+
+#include "VirtualArduino.h"
+#include "Trace.h"
+#include <DeepSleepScheduler.h>
+#include "WaterManager.h"
+#include "ValveManager.h"
+#include "ConfigStore.h"
+#include "RunLog.h"
+#include "StaticArena.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+static const char * const pathNames[] = {"run", "automatic"};
+// the detector per RUN_END_* of the run log, completed and manual are no detection
+static const char * const detectorNames[] = {"-", "-", "threshold", "leak", "noWaterMeter", "flowBand"};
+
+/**
+   Sent from the process that replayed the trace.
+*/
+struct Detection {
+  // one of RUN_END_*, RUN_END_COMPLETED if the run did not end within the trace
+  byte endReason;
+  unsigned long timeUs;
+};
+
+static WaterManager *waterManager;
+
+static bool runEnded() {
+  return !waterManager->isWatering();
+}
+
+/**
+   Starts the run of the first zone as the firmware does and replays the trace until the firmware stops it.
+   Runs in its own process as the firmware keeps its state in globals and the arena.
+*/
+static Detection replay(const Trace &trace, unsigned int threshold) {
+  resetVirtualArduino();
+  resetVirtualEeprom();
+  resetVirtualRtc(0);
+  config.begin();
+  runLog.begin();
+  waterManager = new (arena) WaterManager();
+  waterManager->setWaterMeterStopThreshold(threshold);
+  if (isZoneFlowLearned(trace.baseline)) {
+    config.setZoneFlow(1, trace.baseline);
+  }
+  // modeOff to modeAutomatic
+  waterManager->modeClicked();
+
+  if (trace.path == PATH_RUN) {
+    waterManager->startAutomatic();
+  } else {
+    waterManager->startAutomaticRtc(1);
+  }
+  TracePulses pulses(trace);
+  runVirtualArduino(pulses, trace.endUs, runEnded);
+
+  Detection detection = {RUN_END_COMPLETED, virtualMicros};
+  if (!waterManager->isWatering()) {
+    RunLogRecord record;
+    unsigned long startMinutes;
+    runLog.getRecord(runLog.getCount() - 1, record, startMinutes);
+    detection.endReason = record.endReason;
+  }
+  return detection;
+}
+
+// ----------------------------------------------------------------------------------
+// replay
+// ----------------------------------------------------------------------------------
+static bool replayInChild(const Trace &trace, unsigned int threshold, Detection &detection) {
+  int pipeEnds[2];
+  if (pipe(pipeEnds) != 0) {
+    perror("pipe");
+    return false;
+  }
+  fflush(stdout);
+  const pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    close(pipeEnds[0]);
+    detection = replay(trace, threshold);
+    const bool written = write(pipeEnds[1], &detection, sizeof(detection)) == sizeof(detection);
+    _exit(written ? 0 : 1);
+  }
+  close(pipeEnds[1]);
+  const bool read = ::read(pipeEnds[0], &detection, sizeof(detection)) == sizeof(detection);
+  close(pipeEnds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (!read) {
+    fprintf(stderr, "%s: replay failed\n", trace.name.c_str());
+  }
+  return read;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int threshold = DEFAULT_WATER_METER_STOP_THRESHOLD;
+  int argument = 1;
+  for (; argument < argc && argv[argument][0] == '-'; argument++) {
+    if (strcmp(argv[argument], "-v") == 0) {
+      serialVerbose = true;
+    } else if (strcmp(argv[argument], "-t") == 0 && argument + 1 < argc) {
+      threshold = atoi(argv[++argument]);
+    } else {
+      fprintf(stderr, "usage: %s [-v] [-t threshold] trace...\n", argv[0]);
+      return 2;
+    }
+  }
+  if (argument == argc) {
+    fprintf(stderr, "usage: %s [-v] [-t threshold] trace...\n", argv[0]);
+    return 2;
+  }
+
+  printf("%-32s %-9s %-12s %10s %10s %10s %11s %8s  %s\n",
+         "trace", "path", "detected by", "at ms", "anomaly ms", "latency ms", "lost pulses", "lost l", "result");
+  unsigned int detectedCount = 0;
+  unsigned int falsePositiveCount = 0;
+  unsigned int missedCount = 0;
+  unsigned long maxLatencyUs = 0;
+  unsigned long totalLatencyUs = 0;
+  unsigned long totalLostPulses = 0;
+  for (; argument < argc; argument++) {
+    Trace trace;
+    if (!readTrace(argv[argument], trace)) {
+      return 1;
+    }
+
+    Detection detection;
+    if (!replayInChild(trace, threshold, detection)) {
+      return 1;
+    }
+
+    const bool hasAnomaly = trace.anomalyUs != NO_ANOMALY;
+    const bool hasDetection = detection.endReason != RUN_END_COMPLETED && detection.endReason != RUN_END_MANUAL;
+    const char *result;
+    unsigned long lostPulses = 0;
+    if (hasDetection && (!hasAnomaly || detection.timeUs < trace.anomalyUs)) {
+      result = "false positive";
+      falsePositiveCount++;
+    } else if (hasDetection) {
+      result = "detected";
+      detectedCount++;
+      const unsigned long latencyUs = detection.timeUs - trace.anomalyUs;
+      totalLatencyUs += latencyUs;
+      if (latencyUs > maxLatencyUs) {
+        maxLatencyUs = latencyUs;
+      }
+      lostPulses = countPulses(trace, trace.anomalyUs, detection.timeUs);
+    } else if (hasAnomaly) {
+      result = "missed";
+      missedCount++;
+      lostPulses = countPulses(trace, trace.anomalyUs, ULONG_MAX);
+    } else {
+      result = "ok";
+    }
+    totalLostPulses += lostPulses;
+
+    char atMs[16] = "-";
+    char anomalyMs[16] = "-";
+    char latencyMs[16] = "-";
+    if (hasDetection) {
+      snprintf(atMs, sizeof(atMs), "%.1f", detection.timeUs / 1000.0);
+    }
+    if (hasAnomaly) {
+      snprintf(anomalyMs, sizeof(anomalyMs), "%.1f", trace.anomalyUs / 1000.0);
+    }
+    if (hasDetection && hasAnomaly && detection.timeUs >= trace.anomalyUs) {
+      snprintf(latencyMs, sizeof(latencyMs), "%.1f", (detection.timeUs - trace.anomalyUs) / 1000.0);
+    }
+    printf("%-32s %-9s %-12s %10s %10s %10s %11lu %8.2f  %s\n",
+           trace.name.c_str(), pathNames[trace.path], detectorNames[detection.endReason],
+           atMs, anomalyMs, latencyMs, lostPulses, (double) lostPulses / WATER_METER_PULSES_PER_LITRE, result);
+  }
+
+  printf("\nthreshold: %u pulses per %u ms\n", threshold, WATER_METER_WINDOW_MS);
+  printf("detected: %u, missed: %u, false positives: %u\n", detectedCount, missedCount, falsePositiveCount);
+  if (detectedCount > 0) {
+    printf("latency: mean %.1f ms, max %.1f ms\n", totalLatencyUs / 1000.0 / detectedCount, maxLatencyUs / 1000.0);
+  }
+  printf("water lost: %lu pulses, %.2f l\n", totalLostPulses, (double) totalLostPulses / WATER_METER_PULSES_PER_LITRE);
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Host replacement of the Arduino core for the replay tool, time is the virtual clock of VirtualArduino.cpp
+#ifndef REPLAY_ARDUINO_H
+#define REPLAY_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+inline void *memcpy_P(void *destination, const void *source, size_t length) {
+  return memcpy(destination, source, length);
+}
+template<typename T> inline T pgmRead(const void *address) {
+  T value;
+  memcpy(&value, address, sizeof(T));
+  return value;
+}
+#define pgm_read_byte(p) pgmRead<uint8_t>(p)
+#define pgm_read_word(p) pgmRead<uint16_t>(p)
+#define pgm_read_dword(p) pgmRead<uint32_t>(p)
+#define pgm_read_ptr(p) pgmRead<void *>(p)
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+// bigger than on the Uno as the EEPROMwl indexes are longer with the wider types of the host
+#define E2END 0xFFF
+#define SERIAL_TX_BUFFER_SIZE 64
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void noInterrupts();
+void interrupts();
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *text) {
+      return write((const uint8_t *) text, strlen(text));
+    }
+    virtual int availableForWrite() {
+      return 0;
+    }
+    virtual void flush() {}
+    size_t print(const __FlashStringHelper *text);
+    size_t print(const char text[]);
+    size_t print(char value);
+    size_t print(unsigned char value, int base = DEC);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+    size_t println(const __FlashStringHelper *text);
+    size_t println(const char text[]);
+    size_t println(char value);
+    size_t println(unsigned char value, int base = DEC);
+    size_t println(int value, int base = DEC);
+    size_t println(unsigned int value, int base = DEC);
+    size_t println(long value, int base = DEC);
+    size_t println(unsigned long value, int base = DEC);
+    size_t println(double value, int digits = 2);
+    size_t println();
+};
+
+/**
+   Serial output of the firmware goes to stderr, it is only shown with replay -v.
+*/
+class HardwareSerial: public Print {
+  public:
+    void begin(unsigned long) {}
+    operator bool() {
+      return true;
+    }
+    int available() {
+      return 0;
+    }
+    int read() {
+      return -1;
+    }
+    int peek() {
+      return -1;
+    }
+    int availableForWrite();
+    size_t write(uint8_t value);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
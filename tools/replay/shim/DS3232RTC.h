@@ -0,0 +1,56 @@
+// Host replacement of DS3232RTC, the clock follows the virtual clock of VirtualArduino.cpp
+#ifndef REPLAY_DS3232RTC_H
+#define REPLAY_DS3232RTC_H
+
+#include "Arduino.h"
+#include "TimeLib.h"
+
+enum ALARM_TYPES_t {
+  ALM1_EVERY_SECOND = 0x0F,
+  ALM1_MATCH_SECONDS = 0x0E,
+  ALM1_MATCH_MINUTES = 0x0C,
+  ALM1_MATCH_HOURS = 0x08,
+  ALM1_MATCH_DATE = 0x00,
+  ALM1_MATCH_DAY = 0x10,
+  ALM2_EVERY_MINUTE = 0x8E,
+  ALM2_MATCH_MINUTES = 0x8C,
+  ALM2_MATCH_HOURS = 0x88,
+  ALM2_MATCH_DATE = 0x80,
+  ALM2_MATCH_DAY = 0x90
+};
+
+#define ALARM_1 1
+#define ALARM_2 2
+
+/**
+   Keeps the alarm and control registers like the chip so that readRTC() returns what setAlarm() wrote.
+   Only day and hour matching alarms fire, they are the ones the firmware uses.
+*/
+class DS3232RTC {
+  public:
+    static time_t get();
+    static byte set(time_t time);
+    static byte read(tmElements_t &elements);
+    static byte write(tmElements_t &elements);
+    void setAlarm(ALARM_TYPES_t alarmType, byte seconds, byte minutes, byte hours, byte daydate);
+    void alarmInterrupt(byte alarmNumber, bool alarmEnabled);
+    bool alarm(byte alarmNumber);
+    static byte readRTC(byte address, byte *values, byte length);
+    static byte readRTC(byte address);
+    static byte writeRTC(byte address, byte *values, byte length);
+    static byte writeRTC(byte address, byte value);
+
+    // replay only
+    /**
+       returns the virtual time in us the next enabled alarm fires, ULONG_MAX if none.
+    */
+    unsigned long getNextAlarmUs();
+    /**
+       sets the flag of the alarms due at the current virtual time, returns true if the interrupt output goes low.
+    */
+    bool fireAlarms();
+};
+
+extern DS3232RTC RTC;
+
+#endif
@@ -0,0 +1,37 @@
+// Host replacement of DeepSleepScheduler that runs the callbacks in virtual time
+#ifndef REPLAY_DEEP_SLEEP_SCHEDULER_H
+#define REPLAY_DEEP_SLEEP_SCHEDULER_H
+
+#include "Arduino.h"
+
+class Runnable {
+  public:
+    virtual ~Runnable() {}
+    virtual void run() = 0;
+};
+
+class Scheduler {
+  public:
+    void schedule(Runnable *runnable);
+    void scheduleDelayed(Runnable *runnable, unsigned long delayMs);
+    void removeCallbacks(Runnable *runnable);
+    bool isScheduled(Runnable *runnable) const;
+    void acquireNoSleepLock();
+    void releaseNoSleepLock();
+    unsigned long getMillis() const;
+
+    // replay only
+    /**
+       returns the virtual time in us of the next callback, ULONG_MAX if none.
+    */
+    unsigned long getNextTimeUs() const;
+    /**
+       runs the next callback, the virtual clock must be at its time.
+    */
+    void runNext();
+    void clear();
+};
+
+extern Scheduler scheduler;
+
+#endif
@@ -0,0 +1,35 @@
+// Host replacement of the EEPROM library, the content lives in RAM and the writes are counted
+#ifndef REPLAY_EEPROM_H
+#define REPLAY_EEPROM_H
+
+#include "Arduino.h"
+
+class EEPROMClass {
+  public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    template<typename T> T &get(int address, T &value) {
+      for (size_t i = 0; i < sizeof(T); i++) {
+        ((uint8_t *) &value)[i] = read(address + i);
+      }
+      return value;
+    }
+    template<typename T> const T &put(int address, const T &value) {
+      for (size_t i = 0; i < sizeof(T); i++) {
+        update(address + i, ((const uint8_t *) &value)[i]);
+      }
+      return value;
+    }
+    uint16_t length() {
+      return E2END + 1;
+    }
+
+    // replay only
+    // bytes physically written, unchanged bytes of update() and put() are not written
+    unsigned long writeCount;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,53 @@
+// Host replacement of EEPROMWearLevel, each index keeps its value in RAM and the writes are counted
+#ifndef REPLAY_EEPROM_WEAR_LEVEL_H
+#define REPLAY_EEPROM_WEAR_LEVEL_H
+
+#include "Arduino.h"
+
+#define EEPROM_WEAR_LEVEL_MAX_INDEXES 32
+#define EEPROM_WEAR_LEVEL_MAX_LENGTH 512
+
+class EEPROMWearLevel {
+  public:
+    void begin(byte layoutVersion, int amountOfIndexes, int eepromLengthToUse);
+    void begin(byte layoutVersion, const int lengths[], int amountOfIndexes);
+    template<typename T> T &get(int index, T &value) {
+      // like the library, nothing is read if the index was never written
+      if (indexes[index].length >= (int) sizeof(T)) {
+        memcpy(&value, indexes[index].data, sizeof(T));
+      }
+      return value;
+    }
+    template<typename T> const T &put(int index, const T &value) {
+      if ((int) sizeof(T) > indexes[index].maxDataLength) {
+        // the library cannot store it either
+        abort();
+      }
+      // the library only writes if the value changed
+      if (indexes[index].length != (int) sizeof(T) || memcmp(indexes[index].data, &value, sizeof(T)) != 0) {
+        memcpy(indexes[index].data, &value, sizeof(T));
+        indexes[index].length = sizeof(T);
+        putCount++;
+        // the data bytes and at least one control byte marking them as used
+        writeCount += sizeof(T) + (sizeof(T) + 7) / 8;
+      }
+      return value;
+    }
+    int getMaxDataLength(int index);
+
+    // replay only
+    unsigned long putCount;
+    unsigned long writeCount;
+  private:
+    struct Index {
+      // length of the stored value, 0 if none
+      int length;
+      int maxDataLength;
+      uint8_t data[EEPROM_WEAR_LEVEL_MAX_LENGTH];
+    };
+    Index indexes[EEPROM_WEAR_LEVEL_MAX_INDEXES];
+};
+
+extern EEPROMWearLevel EEPROMwl;
+
+#endif
@@ -0,0 +1,16 @@
+// Host replacement of EnableInterrupt, the replay calls the handler of the pin for every pulse of the trace
+#ifndef REPLAY_ENABLE_INTERRUPT_H
+#define REPLAY_ENABLE_INTERRUPT_H
+
+#include <stdint.h>
+
+void enableInterrupt(uint8_t pin, void (*handler)(), uint8_t mode);
+void disableInterrupt(uint8_t pin);
+
+// replay only
+/**
+   calls the handler of the pin if its interrupt is enabled, returns false if not.
+*/
+bool triggerInterrupt(uint8_t pin);
+
+#endif
@@ -0,0 +1,18 @@
+// Host replacement of MsTimer2, the replay calls the timer function in virtual time
+#ifndef REPLAY_MS_TIMER2_H
+#define REPLAY_MS_TIMER2_H
+
+namespace MsTimer2 {
+  void set(unsigned long ms, void (*function)());
+  void start();
+  void stop();
+
+  // replay only
+  /**
+     returns the virtual time in us the timer fires next, ULONG_MAX if stopped.
+  */
+  unsigned long getNextTimeUs();
+  void fire();
+}
+
+#endif
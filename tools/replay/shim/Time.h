@@ -0,0 +1,2 @@
+// the Time library provides both names
+#include "TimeLib.h"
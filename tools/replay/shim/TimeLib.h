@@ -0,0 +1,37 @@
+// Host replacement of the Time library, the system time follows the virtual clock of VirtualArduino.cpp
+#ifndef REPLAY_TIME_LIB_H
+#define REPLAY_TIME_LIB_H
+
+#include "Arduino.h"
+#include <time.h>
+
+typedef struct {
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  // 1 is Sunday
+  uint8_t Wday;
+  uint8_t Day;
+  uint8_t Month;
+  // offset from 1970
+  uint8_t Year;
+} tmElements_t;
+
+typedef time_t (*getExternalTime)();
+
+time_t now();
+void setTime(time_t time);
+void setTime(int hour, int minute, int second, int day, int month, int year);
+void setSyncProvider(getExternalTime provider);
+void breakTime(time_t time, tmElements_t &elements);
+time_t makeTime(const tmElements_t &elements);
+int year(time_t time);
+int month(time_t time);
+int day(time_t time);
+int hour(time_t time);
+int minute(time_t time);
+int second(time_t time);
+// 1 is Sunday
+int weekday(time_t time);
+
+#endif
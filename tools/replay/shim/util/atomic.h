@@ -0,0 +1,8 @@
+// interrupts are never nested in the replay, the block simply runs once
+#ifndef REPLAY_ATOMIC_H
+#define REPLAY_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (int atomicBlockDone = 0; !atomicBlockDone; atomicBlockDone = 1)
+
+#endif
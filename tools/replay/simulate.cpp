@@ -0,0 +1,249 @@
+/*
+  Simulates daily watering cycles of the firmware in virtual time and reports what they cost. WaterManager,
+  ValveManager, WaterMeter, DurationFsm, ConfigStore, RunLog and WeeklySchedule are compiled unchanged from the
+  sketch. EEPROM, RTC and water meter are simulated. As in WateringSystem.ino, the RTC alarm starts the run.
+
+  usage: simulate [-v] [-l] [-d days]
+    -v  print the serial output of the firmware to stderr
+    -l  start with the legacy daily ALARM_1 and an empty schedule instead of a schedule entry per weekday
+    -d  amount of days to simulate, default 3
+
+  The water meter follows the valves: opening the main valve fills the pipe with PIPE_FILL_PULSES, opening zones
+  adds ZONE_FILL_PULSES, then every open zone flows with ZONE_PULSES_PER_SEC.
+
+  Reported per day:
+    cycle s      from the alarm to the end of the run
+    end          end reason of the run as in the run log
+    litres       counted by the water meter during the run
+    wakeups      the system woke up from deep sleep during the run and during the whole day
+    callbacks    scheduler callbacks during the run
+    awake s      a no-sleep lock was held during the run
+    EEPROMwl     values written and bytes including the control bytes during the whole day, the learned flow
+                 is committed some time after the run
+    EEPROM       bytes written directly during the whole day, i.e. the run log
+*/
+
+#include "VirtualArduino.h"
+#include <DeepSleepScheduler.h>
+#include <EnableInterrupt.h>
+#include <EEPROM.h>
+#include <EEPROMWearLevel.h>
+#include <DS3232RTC.h>
+#include "WaterManager.h"
+#include "ConfigStore.h"
+#include "WeeklySchedule.h"
+#include "RunLog.h"
+#include "StaticArena.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#define US_PER_SECOND 1000000UL
+#define SECONDS_PER_DAY 86400UL
+// the run starts one hour after the simulation
+#define START_HOUR 6
+#define PIPE_FILL_PULSES 50
+#define ZONE_FILL_PULSES 150
+#define FILL_INTERVAL_US 20000UL
+#define ZONE_PULSES_PER_SEC 40
+// resolution of the cycle time
+#define STEP_US 100000UL
+
+static const char * const endReasonNames[] = {"completed", "manual", "threshold", "leak", "noWaterMeter", "flowDeviation"};
+
+static WaterManager *waterManager;
+
+/**
+   Pulses of the water meter derived from the valve pins.
+*/
+class FlowModel: public PulseSource {
+  public:
+    FlowModel(): mainOn(false), openZones(0), fillPulses(0), lastEventUs(0), pulseCount(0) {}
+
+    unsigned long getNextPulseUs() {
+      const bool mainOnNow = digitalRead(VALVE1_PIN) == HIGH;
+      byte openZonesNow = 0;
+      for (byte i = 0; i < ZONE_COUNT; i++) {
+        if (digitalRead(getZonePin(i)) == HIGH) {
+          openZonesNow++;
+        }
+      }
+      if (mainOnNow != mainOn || openZonesNow != openZones) {
+        if (mainOnNow && !mainOn) {
+          fillPulses += PIPE_FILL_PULSES;
+        }
+        if (openZonesNow > openZones) {
+          fillPulses += ZONE_FILL_PULSES;
+        }
+        if (!mainOnNow) {
+          fillPulses = 0;
+        }
+        mainOn = mainOnNow;
+        openZones = openZonesNow;
+        lastEventUs = virtualMicros;
+      }
+      if (!mainOn) {
+        return ULONG_MAX;
+      }
+      if (fillPulses > 0) {
+        return lastEventUs + FILL_INTERVAL_US;
+      }
+      if (openZones == 0) {
+        return ULONG_MAX;
+      }
+      return lastEventUs + US_PER_SECOND / (openZones * ZONE_PULSES_PER_SEC);
+    }
+
+    void next() {
+      lastEventUs = virtualMicros;
+      if (fillPulses > 0) {
+        fillPulses--;
+      }
+      pulseCount++;
+    }
+
+    unsigned long getPulseCount() {
+      return pulseCount;
+    }
+  private:
+    bool mainOn;
+    byte openZones;
+    unsigned int fillPulses;
+    unsigned long lastEventUs;
+    unsigned long pulseCount;
+};
+
+// ----------------------------------------------------------------------------------
+// RTC interrupt as in WateringSystem.ino
+// ----------------------------------------------------------------------------------
+class RtcScheduled: public Runnable {
+    void run() {
+      if (RTC.alarm(ALARM_1)) {
+        waterManager->startAutomaticRtc(weeklySchedule.fire());
+      }
+      RTC.alarm(ALARM_2);
+    }
+};
+static RtcScheduled rtcScheduled;
+
+static void isrRtc() {
+  scheduler.schedule(&rtcScheduled);
+}
+
+// ----------------------------------------------------------------------------------
+// simulation
+// ----------------------------------------------------------------------------------
+struct Counters {
+  unsigned long timeUs;
+  VirtualStats stats;
+  unsigned long wearLevelPuts;
+  unsigned long wearLevelWrites;
+  unsigned long eepromWrites;
+  unsigned long pulses;
+};
+
+static void readCounters(Counters &counters, FlowModel &flow) {
+  counters.timeUs = virtualMicros;
+  counters.stats = virtualStats;
+  counters.wearLevelPuts = EEPROMwl.putCount;
+  counters.wearLevelWrites = EEPROMwl.writeCount;
+  counters.eepromWrites = EEPROM.writeCount;
+  counters.pulses = flow.getPulseCount();
+}
+
+static void setup(bool legacyAlarm) {
+  resetVirtualArduino();
+  resetVirtualEeprom();
+  // 2026-10-18 is a Sunday
+  tmElements_t start = {0, 0, START_HOUR - 1, 1, 18, 10, 2026 - 1970};
+  resetVirtualRtc(makeTime(start));
+
+  config.begin();
+  runLog.begin();
+  waterManager = new (arena) WaterManager();
+  if (legacyAlarm) {
+    // as set by the versions before the weekly schedule
+    RTC.setAlarm(ALM1_MATCH_HOURS, 0, 0, START_HOUR, 0);
+    RTC.alarmInterrupt(ALARM_1, true);
+  }
+  // initRtc() of WateringSystem.ino
+  RTC.alarm(ALARM_1);
+  RTC.alarm(ALARM_2);
+  weeklySchedule.migrateRtcAlarms();
+  weeklySchedule.programNextAlarm();
+  if (!legacyAlarm) {
+    for (byte weekday = 1; weekday <= 7; weekday++) {
+      weeklySchedule.add(weekday, START_HOUR, 0, ALL_ZONES);
+    }
+  }
+  pinMode(RTC_INT_PIN, INPUT_PULLUP);
+  enableInterrupt(RTC_INT_PIN, isrRtc, FALLING);
+  // modeOff to modeAutomatic
+  waterManager->modeClicked();
+}
+
+int main(int argc, char *argv[]) {
+  bool legacyAlarm = false;
+  unsigned int days = 3;
+  for (int argument = 1; argument < argc; argument++) {
+    if (strcmp(argv[argument], "-v") == 0) {
+      serialVerbose = true;
+    } else if (strcmp(argv[argument], "-l") == 0) {
+      legacyAlarm = true;
+    } else if (strcmp(argv[argument], "-d") == 0 && argument + 1 < argc) {
+      days = atoi(argv[++argument]);
+    } else {
+      fprintf(stderr, "usage: %s [-v] [-l] [-d days]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  setup(legacyAlarm);
+  FlowModel flow;
+  printf("%-3s %8s %-13s %7s %8s %9s %9s %8s %13s %7s\n",
+         "day", "cycle s", "end", "litres", "wakeups", "callbacks", "awake s", "day wakeups", "EEPROMwl", "EEPROM");
+  for (unsigned int day = 1; day <= days; day++) {
+    const unsigned long dayEndUs = day * SECONDS_PER_DAY * US_PER_SECOND;
+    Counters dayStart;
+    readCounters(dayStart, flow);
+    Counters cycleStart;
+    Counters cycleEnd;
+    bool started = false;
+    bool ended = false;
+    while (virtualMicros < dayEndUs) {
+      runVirtualArduino(flow, virtualMicros + STEP_US);
+      if (!started && waterManager->isWatering()) {
+        started = true;
+        readCounters(cycleStart, flow);
+      } else if (started && !ended && !waterManager->isWatering()) {
+        ended = true;
+        readCounters(cycleEnd, flow);
+      }
+    }
+    Counters dayEnd;
+    readCounters(dayEnd, flow);
+
+    if (!ended) {
+      printf("%-3u no run\n", day);
+      continue;
+    }
+    RunLogRecord record;
+    unsigned long startMinutes;
+    runLog.getRecord(runLog.getCount() - 1, record, startMinutes);
+    char wearLevel[24];
+    snprintf(wearLevel, sizeof(wearLevel), "%lu/%lu B", dayEnd.wearLevelPuts - dayStart.wearLevelPuts,
+             dayEnd.wearLevelWrites - dayStart.wearLevelWrites);
+    printf("%-3u %8.1f %-13s %7.1f %8lu %9lu %9.1f %8lu %13s %5lu B\n", day,
+           (cycleEnd.timeUs - cycleStart.timeUs) / (double) US_PER_SECOND,
+           record.endReason < sizeof(endReasonNames) / sizeof(endReasonNames[0]) ? endReasonNames[record.endReason] : "?",
+           (double) (cycleEnd.pulses - cycleStart.pulses) / WATER_METER_PULSES_PER_LITRE,
+           cycleEnd.stats.wakeups - cycleStart.stats.wakeups,
+           cycleEnd.stats.callbacks - cycleStart.stats.callbacks,
+           (cycleEnd.stats.awakeUs - cycleStart.stats.awakeUs) / (double) US_PER_SECOND,
+           dayEnd.stats.wakeups - dayStart.stats.wakeups,
+           wearLevel, dayEnd.eepromWrites - dayStart.eepromWrites);
+  }
+  printf("\narena used: %u of %u bytes (host sizes)\n", (unsigned int) arena.getUsed(), (unsigned int) arena.getSize());
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+  Compares the stop threshold detection of WaterMeter with a sliding window to the fixed windows it replaced, on
+  the same pulse traces as replay. The sliding window is WaterMeter compiled unchanged from the sketch. The fixed
+  windows are FixedWindowMeter below, the pulse and timer interrupts of WaterMeter before the sliding window.
+
+  usage: window [-t threshold] trace...
+    -t  stop threshold in pulses per window instead of DEFAULT_WATER_METER_STOP_THRESHOLD
+
+  Where the windows start relative to the anomaly depends on when the run started. Every trace is replayed
+  PHASE_COUNT times, delayed by a fraction of WATER_METER_WINDOW_MS each time. The threshold is supervised from the
+  start of the trace, the flow band is not supervised. Traces with path automatic are skipped, the leak check does
+  not use the threshold.
+
+  Reported per trace and window:
+    detected     phases in which the threshold was reached before the end of the trace
+    mean/max ms  latency from the anomaly to the detection over these phases
+  A detection before the anomaly or in a trace without anomaly is a false positive.
+*/
+
+#include "VirtualArduino.h"
+#include "Trace.h"
+#include <DeepSleepScheduler.h>
+#include <MsTimer2.h>
+#include <EnableInterrupt.h>
+#include "WaterMeter.h"
+#include "WaterManager.h"
+#include "ConfigStore.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+// replays per trace, the phases are WATER_METER_WINDOW_MS / PHASE_COUNT apart
+#define PHASE_COUNT 20
+#define NO_DETECTION ULONG_MAX
+
+/**
+   Counts the pulses in consecutive windows of windowMs and reports a window with samplesInInterval or more pulses
+   when it ends, as WaterMeter did before the sliding window.
+*/
+class FixedWindowMeter {
+  public:
+    FixedWindowMeter(const unsigned long windowMs, const unsigned int samplesInInterval, Runnable *listener) {
+      FixedWindowMeter::samplesInInterval = samplesInInterval;
+      FixedWindowMeter::listener = listener;
+      totalPulseCount = 0;
+      lastPulseCount = 0;
+      MsTimer2::set(windowMs, FixedWindowMeter::isrTimer);
+    }
+    void start() {
+      enableInterrupt(WATER_METER_PIN, FixedWindowMeter::isrWaterMeterPulses, FALLING);
+      MsTimer2::start();
+    }
+  private:
+    static void isrWaterMeterPulses() {
+      totalPulseCount++;
+    }
+    static void isrTimer() {
+      unsigned int pulsesCount = totalPulseCount - lastPulseCount;
+      lastPulseCount = totalPulseCount;
+      if (listener != NULL && pulsesCount >= samplesInInterval) {
+        scheduler.schedule(listener);
+      }
+    }
+    static Runnable *listener;
+    static unsigned int samplesInInterval;
+    static unsigned long totalPulseCount;
+    static unsigned long lastPulseCount;
+};
+Runnable *FixedWindowMeter::listener;
+unsigned int FixedWindowMeter::samplesInInterval;
+unsigned long FixedWindowMeter::totalPulseCount;
+unsigned long FixedWindowMeter::lastPulseCount;
+
+/**
+   Keeps the time the threshold listener was called first.
+*/
+class ThresholdListener: public Runnable {
+  public:
+    void run() {
+      if (timeUs == NO_DETECTION) {
+        timeUs = virtualMicros;
+      }
+    }
+    unsigned long timeUs;
+};
+static ThresholdListener thresholdListener;
+
+static bool detected() {
+  return thresholdListener.timeUs != NO_DETECTION;
+}
+
+/**
+   returns the virtual time of the detection relative to the trace, NO_DETECTION if there was none.
+*/
+static unsigned long detect(const Trace &trace, unsigned int threshold, bool slidingWindow, unsigned long offsetUs) {
+  resetVirtualArduino();
+  thresholdListener.timeUs = NO_DETECTION;
+  TracePulses pulses(trace, offsetUs);
+  if (slidingWindow) {
+    WaterMeter waterMeter(WATER_METER_WINDOW_MS);
+    waterMeter.setThresholdListener(threshold, &thresholdListener);
+    waterMeter.start();
+    runVirtualArduino(pulses, trace.endUs + offsetUs, detected);
+    waterMeter.stop();
+  } else {
+    FixedWindowMeter fixedWindowMeter(WATER_METER_WINDOW_MS, threshold, &thresholdListener);
+    fixedWindowMeter.start();
+    runVirtualArduino(pulses, trace.endUs + offsetUs, detected);
+  }
+  return detected() ? thresholdListener.timeUs - offsetUs : NO_DETECTION;
+}
+
+struct Result {
+  unsigned int detectedCount;
+  unsigned int falsePositiveCount;
+  unsigned long totalLatencyUs;
+  unsigned long maxLatencyUs;
+};
+
+static void addDetection(Result &result, const Trace &trace, unsigned long timeUs) {
+  if (timeUs == NO_DETECTION) {
+    return;
+  }
+  if (trace.anomalyUs == NO_ANOMALY || timeUs < trace.anomalyUs) {
+    result.falsePositiveCount++;
+    return;
+  }
+  const unsigned long latencyUs = timeUs - trace.anomalyUs;
+  result.detectedCount++;
+  result.totalLatencyUs += latencyUs;
+  if (latencyUs > result.maxLatencyUs) {
+    result.maxLatencyUs = latencyUs;
+  }
+}
+
+static void printResult(const Result &result) {
+  char detectedText[16];
+  char meanMs[16] = "-";
+  char maxMs[16] = "-";
+  snprintf(detectedText, sizeof(detectedText), "%u/%u", result.detectedCount, PHASE_COUNT);
+  if (result.detectedCount > 0) {
+    snprintf(meanMs, sizeof(meanMs), "%.1f", result.totalLatencyUs / 1000.0 / result.detectedCount);
+    snprintf(maxMs, sizeof(maxMs), "%.1f", result.maxLatencyUs / 1000.0);
+  }
+  printf("  %8s %8s %8s %5u", detectedText, meanMs, maxMs, result.falsePositiveCount);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int threshold = DEFAULT_WATER_METER_STOP_THRESHOLD;
+  int argument = 1;
+  if (argument + 1 < argc && strcmp(argv[argument], "-t") == 0) {
+    threshold = atoi(argv[argument + 1]);
+    argument += 2;
+  }
+  if (argument == argc || argv[argument][0] == '-') {
+    fprintf(stderr, "usage: %s [-t threshold] trace...\n", argv[0]);
+    return 2;
+  }
+
+  printf("%-32s %10s  %-32s  %-32s\n", "", "", "fixed windows", "sliding window");
+  printf("%-32s %10s  %8s %8s %8s %5s  %8s %8s %8s %5s\n", "trace", "anomaly ms",
+         "detected", "mean ms", "max ms", "false", "detected", "mean ms", "max ms", "false");
+  for (; argument < argc; argument++) {
+    Trace trace;
+    if (!readTrace(argv[argument], trace)) {
+      return 1;
+    }
+    if (trace.path != PATH_RUN) {
+      continue;
+    }
+    Result fixedResult;
+    Result slidingResult;
+    memset(&fixedResult, 0, sizeof(fixedResult));
+    memset(&slidingResult, 0, sizeof(slidingResult));
+    for (unsigned int phase = 0; phase < PHASE_COUNT; phase++) {
+      const unsigned long offsetUs = phase * (WATER_METER_WINDOW_MS * 1000UL / PHASE_COUNT);
+      addDetection(fixedResult, trace, detect(trace, threshold, false, offsetUs));
+      addDetection(slidingResult, trace, detect(trace, threshold, true, offsetUs));
+    }
+
+    char anomalyMs[16] = "-";
+    if (trace.anomalyUs != NO_ANOMALY) {
+      snprintf(anomalyMs, sizeof(anomalyMs), "%.1f", trace.anomalyUs / 1000.0);
+    }
+    printf("%-32s %10s", trace.name.c_str(), anomalyMs);
+    printResult(fixedResult);
+    printResult(slidingResult);
+    printf("\n");
+  }
+  printf("\nthreshold: %u pulses per %u ms, %u phases %lu ms apart\n", threshold, WATER_METER_WINDOW_MS,
+         PHASE_COUNT, (unsigned long) WATER_METER_WINDOW_MS / PHASE_COUNT);
+  return 0;
+}
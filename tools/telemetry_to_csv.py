@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Convert recorded serial output of a WateringSystem into CSV rows of its telemetry frames.
+
+Frames are found between 0 bytes, COBS decoded and checked against their CRC.
+ASCII output and other frames on the same link are skipped.
+See BinaryProtocol.h and Telemetry.h for the format.
+
+usage: telemetry_to_csv.py [recording] > telemetry.csv
+"""
+
+import csv
+import struct
+import sys
+
+FRAME_TELEMETRY = 0x04
+FRAME_RESPONSE = 0x80
+# TelemetryFrame in Telemetry.h, little endian without padding
+TELEMETRY_FORMAT = "<IIIHHBBBB"
+
+VALVE_STATES = ["idle", "leakCheckFill", "leakCheckWait", "warn", "waitBefore", "zone", "leak"]
+MODES = ["off", "automatic", "offOnce"]
+FLAG_WATERING = 0x01
+FLAG_THRESHOLD_SUPERVISED = 0x02
+FLAG_STOPPED_BY_THRESHOLD = 0x04
+
+COLUMNS = ["sequence", "uptime_ms", "awake_ms", "total_pulses", "flow_per_min", "stopped_by_threshold",
+           "valve_state", "zone", "mode", "watering", "threshold_supervised", "dropped_before"]
+
+
+def cobs_decode(data):
+    decoded = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        index += 1
+        if code == 0 or index + code - 1 > len(data):
+            return None
+        decoded += data[index:index + code - 1]
+        index += code - 1
+        if code < 0xFF and index < len(data):
+            decoded.append(0)
+    return bytes(decoded)
+
+
+def crc16_ccitt_false(data):
+    crc = 0xFFFF
+    for value in data:
+        crc ^= value << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(stream):
+    """Yields type, sequence and data of every valid frame."""
+    for chunk in stream.split(b"\x00"):
+        payload = cobs_decode(chunk) if chunk else None
+        if payload is None or len(payload) < 4:
+            continue
+        crc = payload[-2] | (payload[-1] << 8)
+        if crc != crc16_ccitt_false(payload[:-2]):
+            continue
+        yield payload[0], payload[1], payload[2:-2]
+
+
+def main():
+    stream = open(sys.argv[1], "rb").read() if len(sys.argv) > 1 else sys.stdin.buffer.read()
+    writer = csv.writer(sys.stdout)
+    writer.writerow(COLUMNS)
+    size = struct.calcsize(TELEMETRY_FORMAT)
+    previous_sequence = None
+    for frame_type, sequence, data in frames(stream):
+        if frame_type != FRAME_TELEMETRY | FRAME_RESPONSE or len(data) != size:
+            continue
+        (uptime, awake, pulses, flow, stopped, valve_state, zone, mode, flags) = struct.unpack(TELEMETRY_FORMAT, data)
+        # frames dropped on the device because the serial buffer was full
+        dropped = 0 if previous_sequence is None else (sequence - previous_sequence - 1) % 256
+        previous_sequence = sequence
+        writer.writerow([
+            sequence, uptime, awake, pulses, flow, stopped,
+            VALVE_STATES[valve_state] if valve_state < len(VALVE_STATES) else valve_state,
+            zone + 1, MODES[mode] if mode < len(MODES) else mode,
+            int(bool(flags & FLAG_WATERING)), int(bool(flags & FLAG_THRESHOLD_SUPERVISED)), dropped])
+
+
+if __name__ == "__main__":
+    main()